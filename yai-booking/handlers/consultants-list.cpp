@@ -1,52 +1,121 @@
 #include <cstdint>
-#include <libpq-fe.h>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include <yai-dict.hpp>
 
 #include "../yai-booking-handlers.hpp"
 
 namespace yai::booking::handlers {
 
-Awaitable<void> ListConsultants(Stream &stream) {
-  PGconn *conn = PQconnectdb("dbname=yai user=postgres");
+namespace {
 
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PQfinish(conn);
+// The consultants list frame, encoded once per consultants version and
+// rebuilt by the dictionary listener whenever consultants change.
+struct ConsultantsFrame {
+  explicit ConsultantsFrame(std::uint64_t v, Messager m)
+      : version{v}, messager{std::move(m)}, data{messager.Flush()},
+        size{messager.size()} {}
 
-    Messager messager = Messager::MakeErrors("Connection error");
+  std::uint64_t version;
+  Messager messager;
+  const void *data;
+  std::uint32_t size;
+};
 
-    co_await stream.Write(messager.Flush(), messager.size());
-    co_return;
+class ConsultantsResponse {
+public:
+  std::shared_ptr<const ConsultantsFrame>
+  Get(const dict::Dictionary &consultants) {
+    std::shared_ptr<const ConsultantsFrame> frame = Load();
+
+    if (frame && frame->version == consultants.version())
+      return frame;
+
+    // One rebuild per version: callers that find the frame stale while it
+    // is being rebuilt wait for it and take the new frame.
+    std::lock_guard rebuilding{rebuild_mutex_};
+
+    frame = Load();
+    if (!frame || frame->version != consultants.version())
+      frame = Rebuild(consultants);
+
+    return frame;
   }
 
-  PGresult *res = PQexec(conn, "SELECT id, name FROM yai_booking_consultant");
+  std::shared_ptr<const ConsultantsFrame>
+  Rebuild(const dict::Dictionary &consultants) {
+    std::uint64_t version = 0;
 
-  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-    PQclear(res);
-    PQfinish(conn);
+    Messager messager = consultants.Read([&](const auto &names) {
+      version = consultants.version();
 
-    Messager messager = Messager::MakeErrors("Execution error");
+      std::size_t reserve = 3 * sizeof(std::uint32_t);
+      names.ForEach([&](std::int32_t, const std::string &name) {
+        reserve += 2 * sizeof(std::uint32_t) + name.size();
+      });
 
-    co_await stream.Write(messager.Flush(), messager.size());
-    co_return;
+      Messager m{reserve};
+      m.Status(0);
+
+      m.AppendNarrow(static_cast<std::uint32_t>(names.size()));
+
+      names.ForEach([&](std::int32_t id, const std::string &name) {
+        m.AppendNarrow(id);
+        m.AppendNarrow(static_cast<std::uint32_t>(name.size()));
+        m.AppendNarrow(name.c_str());
+      });
+
+      return m;
+    });
+
+    auto frame =
+        std::make_shared<const ConsultantsFrame>(version, std::move(messager));
+
+    std::lock_guard lock{mutex_};
+    if (!frame_ || frame_->version < version)
+      frame_ = frame;
+
+    return frame;
+  }
+
+private:
+  std::shared_ptr<const ConsultantsFrame> Load() {
+    std::lock_guard lock{mutex_};
+    return frame_;
   }
 
-  int n = PQntuples(res);
+  std::mutex mutex_, rebuild_mutex_;
+  std::shared_ptr<const ConsultantsFrame> frame_;
+};
 
-  Messager messager{static_cast<std::size_t>(n) * 128};
-  messager.Status(0);
+ConsultantsResponse consultants_response;
 
-  messager.AppendNarrow(n);
+} // namespace
 
-  for (int i = 0; i < n; i++) {
-    int id = std::stoi(PQgetvalue(res, i, 0));
-    messager.AppendNarrow(id);
+Awaitable<void> ListConsultants(Stream &stream) {
+  dict::Cache &cache = dict::Cache::Instance();
+
+  static const bool subscribed = [&] {
+    cache.OnChange([] {
+      consultants_response.Get(dict::Cache::Instance().consultants());
+    });
+    return true;
+  }();
+  static_cast<void>(subscribed);
 
-    const char *name = PQgetvalue(res, i, 1);
+  if (cache.Start("dbname=yai user=postgres")) {
+    Messager messager = Messager::MakeErrors("Connection error");
 
-    messager.AppendNarrow(static_cast<std::uint32_t>(std::strlen(name)));
-    messager.AppendNarrow(name);
+    co_await stream.Write(messager.Flush(), messager.size());
+    co_return;
   }
 
-  co_await stream.Write(messager.Flush(), messager.size());
+  std::shared_ptr<const ConsultantsFrame> frame =
+      consultants_response.Get(cache.consultants());
+
+  co_await stream.Write(frame->data, frame->size);
 }
 
 } // namespace yai::booking::handlers
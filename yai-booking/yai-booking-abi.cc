@@ -1,683 +1,1176 @@
+#include <algorithm>
+#include <atomic>
 #include <boost/json.hpp>
 #include <libpq-fe.h>
 #include <pyAi.hpp>
 #include <sstream>
-#include <xai.hpp>
+#include <thread>
+#include <yai-arena.hpp>
+#include <yai-dict.hpp>
+#include <yai-flatmap.hpp>
+#include <yai-mmap.hpp>
+#include <yai-pq.hpp>
+#include <yai-singleflight.hpp>
+#include <yai-time.hpp>
+#include <yai-validate.hpp>
+
+#include "yai-booking-summary.hpp"
+
+namespace PQ_Utils {
+
+// Appends a Postgres array literal, e.g. {"Bruce Wayne","Clark Kent"}.
+template <class S, class R>
+inline static void AppendArray(S &out, const R &items) {
+  out.push_back('{');
+
+  bool first = true;
+  for (const std::string_view item : items) {
+    if (!first)
+      out.push_back(',');
+    first = false;
+
+    out.push_back('"');
+    yai::validate::AppendArrayElement(out, item);
+    out.push_back('"');
+  }
 
-static pyAi::ABISettings abi_settings;
+  out.push_back('}');
+}
 
-namespace ImportJSON_Utils {
+inline static bool Exec(PGconn *conn, const char *query, pyAi::Error &error) {
+  PGresult *res = PQexec(conn, query);
+  const bool failed = PQresultStatus(res) != PGRES_COMMAND_OK;
 
-inline static nullptr_t ArrayParseError(const std::exception &e) {
-  std::ostringstream oss;
-  oss << "Error parsing JSON: " << e.what();
+  if (failed)
+    error.Set(PyExc_RuntimeError, PQresultErrorMessage(res));
 
-  PyErr_SetString(PyExc_ValueError, oss.str().c_str());
-  return nullptr;
-}
+  PQclear(res);
 
-inline static bool ValidateName(const std::string &name) {
-  return std::string_view::npos !=
-         name.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
-                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                "áéíóúñ ");
+  return failed;
 }
 
-inline static bool ValidateVisitedAt(const std::string &visited_at) {
-  return std::string_view::npos !=
-         visited_at.find_first_not_of("0123456789-:TZ ");
+inline static void PutIds(PGresult *res, yai::dict::Dictionary &dictionary) {
+  const int rows = PQntuples(res);
+  for (int i = 0; i < rows; ++i)
+    dictionary.Put(std::stoi(PQgetvalue(res, i, 0)),
+                   std::string_view{PQgetvalue(res, i, 1),
+                                    static_cast<std::size_t>(
+                                        PQgetlength(res, i, 1))});
 }
 
-inline static std::size_t
-GetMapCount(std::unordered_map<std::string, std::size_t> &map,
-            const std::string &key, std::size_t &count) {
-  if (map.contains(key)) {
-    return map[key];
+} // namespace PQ_Utils
+
+namespace Import_Utils {
+
+// Read-only view of any object supporting the buffer protocol (bytes,
+// bytearray, memoryview, mmap, ...), held for the lifetime of this object.
+class Buffer {
+public:
+  Buffer() = default;
+  ~Buffer() {
+    if (view_.obj)
+      PyBuffer_Release(&view_);
   }
 
-  map[key] = count;
-  return count++;
-}
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
 
-inline static std::string CleanComment(const std::string_view &comment_raw) {
-  static constexpr std::size_t OFFSET = 32;
+  bool Get(PyObject *object) {
+    return PyObject_GetBuffer(object, &view_, PyBUF_SIMPLE) < 0;
+  }
 
-  std::string comment;
-  comment.reserve(comment_raw.size() + OFFSET);
+  std::string_view view() const {
+    return {static_cast<const char *>(view_.buf),
+            static_cast<std::size_t>(view_.len)};
+  }
 
-  for (const char &c : comment_raw) {
-    if (c == '\'') {
-      comment.push_back('\'');
+private:
+  Py_buffer view_{};
+};
+
+// Mapping of a path (str, bytes or os.PathLike), a file descriptor or an
+// object with fileno(), so large uploads are parsed in place instead of
+// being read into memory.
+class File {
+public:
+  bool Get(PyObject *file) {
+    bool failed;
+
+    if (PyLong_Check(file) || PyObject_HasAttrString(file, "fileno")) {
+      const int fd = PyObject_AsFileDescriptor(file);
+      if (fd < 0)
+        return true;
+
+      failed = mapped_.Open(fd);
+    } else {
+      PyObject *path = nullptr;
+      if (!PyUnicode_FSConverter(file, &path))
+        return true;
+
+      failed = mapped_.Open(PyBytes_AS_STRING(path));
+      Py_DECREF(path);
     }
-    comment.push_back(c);
-  }
 
-  return comment;
-}
+    if (failed) {
+      PyErr_SetString(PyExc_OSError, mapped_.error());
+      return true;
+    }
 
-inline static bool InsertConsultants(
-    PGconn *conn,
-    const std::unordered_map<std::string, std::size_t> &consultant_map) {
-  std::ostringstream oss;
-  oss << "INSERT INTO yai_booking_consultant (name) VALUES ";
+    return false;
+  }
 
-  std::vector<const std::string *> order;
-  order.resize(consultant_map.size());
+  std::string_view view() const { return mapped_.view(); }
+
+private:
+  yai::MappedFile mapped_;
+};
+
+// A rejected input row; message is a static string.
+struct RowError {
+  std::uint32_t row;
+  const char *message;
+};
+
+// What an import hands back to Python. It is filled with the GIL released.
+struct Outcome {
+  pyAi::Error error;
+  std::vector<RowError> rejected;
+};
+
+struct Booking {
+  std::int32_t consultant_id, customer_id;
+  yai::time::PgTimestamp visited_at;
+  std::string_view comment;
+};
+
+// An import of Source (Buffer or File) whose result is the list of rejected
+// rows, [(row, message), ...]. Import runs without the GIL.
+template <class Source, void (*Import)(const pyAi::ABISettings &,
+                                       std::string_view, Outcome &)>
+struct RowsTask {
+  std::shared_ptr<const pyAi::ABISettings> settings;
+  Source source;
+  Outcome outcome;
+
+  bool Prepare(PyObject *arg) { return source.Get(arg); }
+
+  void Run(pyAi::ThreadState &) { Import(*settings, source.view(), outcome); }
+
+  PyObject *Finish() {
+    if (outcome.error)
+      return outcome.error.Raise();
+
+    PyObject *list =
+        PyList_New(static_cast<Py_ssize_t>(outcome.rejected.size()));
+    if (!list)
+      return nullptr;
+
+    Py_ssize_t i = 0;
+    for (const RowError &rejected : outcome.rejected) {
+      PyObject *item = Py_BuildValue("(Is)", rejected.row, rejected.message);
+      if (!item) {
+        Py_DECREF(list);
+        return nullptr;
+      }
+      PyList_SET_ITEM(list, i++, item);
+    }
 
-  for (const auto &[name, id] : consultant_map) {
-    order[id] = &name;
+    return list;
   }
+};
 
-  auto it = order.begin();
-  oss << "('" << *it << "')";
-  ++it;
+inline static PGconn *Connect(const pyAi::ABISettings &settings,
+                              pyAi::Error &error) {
+  PGconn *conn = PQconnectdb(settings.conninfo.c_str());
 
-  while (it != order.end()) {
-    oss << ", ('" << *it << "')";
-    ++it;
+  if (PQstatus(conn) != CONNECTION_OK) {
+    error.Set(PyExc_ConnectionError, PQerrorMessage(conn));
+    PQfinish(conn);
+    return nullptr;
   }
 
-  oss << " RETURNING id";
+  return conn;
+}
 
-  PGresult *res = PQexec(conn, oss.str().c_str());
+// Values go over the wire already in binary form, so the server does no
+// text parsing for ids or timestamps.
+template <class R>
+inline static bool CopyBookings(PGconn *conn, const R &bookings,
+                                pyAi::Error &error) {
+  yai::pq::BinaryCopy copy{conn};
 
-  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(res));
-    PQclear(res);
-    PQfinish(conn);
-    return true;
+  if (copy.Begin("COPY yai_booking_book (consultant_id, customer_id, "
+                 "visited_at, comment) FROM STDIN (FORMAT binary)"))
+    return error.Set(PyExc_RuntimeError, copy.error());
+
+  for (const Booking &booking : bookings) {
+    if (copy.Row(4))
+      break;
+
+    copy.Int4(booking.consultant_id);
+    copy.Int4(booking.customer_id);
+    copy.Timestamp(booking.visited_at);
+    copy.Text(booking.comment);
   }
 
-  PQclear(res);
+  if (copy.End())
+    return error.Set(PyExc_RuntimeError, copy.error());
 
   return false;
 }
 
-} // namespace ImportJSON_Utils
+} // namespace Import_Utils
 
-static PyObject *ImportJSON(PyObject *, PyObject *bytes) {
-  if (!PyBytes_Check(bytes)) {
-    PyErr_SetString(PyExc_TypeError, "Expected a bytes");
-    return nullptr;
-  }
+namespace ImportJSON_Utils {
 
-  Py_ssize_t size = PyBytes_Size(bytes);
-  if (size < 0) {
-    PyErr_SetString(PyExc_TypeError, "Empty bytes");
-    return nullptr;
-  }
+// Names are interned ids of the batch; the comment lives in its arena.
+struct BookRow {
+  std::uint32_t row, consultant, customer;
+  yai::time::PgTimestamp visited_at;
+  std::string_view comment;
+};
 
-  const char *buffer = PyBytes_AsString(bytes);
-  if (!buffer) {
-    PyErr_SetString(PyExc_TypeError, "Error getting buffer");
-    return nullptr;
+// Rows are staged and written a batch at a time, so that an upload of any
+// size is never held in memory as a whole.
+static constexpr std::size_t BATCH_ROWS = 8192;
+
+struct Batch {
+  yai::Arena arena;
+  yai::Interner consultants{arena}, customers{arena};
+  yai::Arena::Vector<BookRow> rows = arena.MakeVector<BookRow>();
+};
+
+using IdVector = yai::Arena::Vector<std::int32_t>;
+
+using ResolvedIds = yai::FlatMap<std::string, std::int32_t>;
+
+// The import's transaction. The ids it resolved go to the shared cache
+// only once it commits.
+struct Transaction {
+  PGconn *conn;
+  ResolvedIds consultants, customers;
+  std::size_t copied = 0;
+
+  explicit Transaction(PGconn *c) : conn{c} {}
+};
+
+inline static bool ArrayParseError(pyAi::Error &error,
+                                   const std::string &what) {
+  std::ostringstream oss;
+  oss << "Error parsing JSON: " << what;
+
+  return error.Set(PyExc_ValueError, oss.str());
+}
+
+inline static bool GetString(const boost::json::object &object,
+                             std::string_view key, std::string_view &out) {
+  const boost::json::value *value = object.if_contains(key);
+  if (!value)
+    return false;
+
+  const boost::json::string *string = value->if_string();
+  if (!string)
+    return false;
+
+  out = *string;
+  return true;
+}
+
+// Insert the missing names and return the id of every name in $1. Rows
+// inserted by the CTE are not visible to the join, so nothing repeats.
+static constexpr const char *RESOLVE_CONSULTANTS_Q =
+    "WITH input AS (SELECT unnest($1::varchar[]) AS name), "
+    "inserted AS (INSERT INTO yai_booking_consultant (name) "
+    "SELECT name FROM input ON CONFLICT (name) DO NOTHING RETURNING id, name) "
+    "SELECT id, name FROM inserted UNION ALL SELECT C.id, C.name "
+    "FROM yai_booking_consultant C JOIN input USING (name)";
+
+static constexpr const char *RESOLVE_CUSTOMERS_Q =
+    "WITH input AS (SELECT unnest($1::varchar[]) AS name), "
+    "inserted AS (INSERT INTO yai_booking_customer (name) "
+    "SELECT name FROM input ON CONFLICT (name) DO NOTHING RETURNING id, name) "
+    "SELECT id, name FROM inserted UNION ALL SELECT C.id, C.name "
+    "FROM yai_booking_customer C JOIN input USING (name)";
+
+// Maps each interned name to its database id, or -1 when the name did not
+// come back (raced with a concurrent insert or delete). Returns true when
+// some name is missing.
+inline static bool MapIds(PGresult *res, const yai::Interner &names,
+                          IdVector &ids, ResolvedIds &resolved) {
+  const int rows = PQntuples(res);
+  yai::FlatMap<std::string_view, std::int32_t> found{
+      static_cast<std::size_t>(rows)};
+
+  for (int i = 0; i < rows; ++i) {
+    const std::string_view name{
+        PQgetvalue(res, i, 1),
+        static_cast<std::size_t>(PQgetlength(res, i, 1))};
+    const auto id = static_cast<std::int32_t>(std::stol(PQgetvalue(res, i, 0)));
+
+    found.Put(name, id);
+    resolved.Put(name, id);
   }
 
-  boost::json::array payload_array;
-  try {
-    payload_array = boost::json::parse(buffer).as_array();
-  } catch (const std::exception &e) {
-    return ImportJSON_Utils::ArrayParseError(e);
+  bool missing = false;
+
+  ids.resize(names.size());
+  for (std::uint32_t i = 0; i < names.size(); ++i) {
+    const std::int32_t *id = found.Find(names[i]);
+    ids[i] = id ? *id : -1;
+    missing = missing || !id;
   }
 
-  std::vector<std::pair<boost::json::object, std::vector<const char *>>>
-      bad_objects;
-  bad_objects.reserve(payload_array.size());
+  return missing;
+}
 
-  std::vector<std::tuple<std::size_t, std::size_t, std::string, std::string>>
-      bulk_objects;
-  bulk_objects.reserve(payload_array.size());
+// A name inserted by another import that committed while ours waited on it
+// is missing from the snapshot of the join, so missing names get one more
+// round with a fresh snapshot.
+inline static bool ResolveNames(Transaction &tx, Batch &batch,
+                                IdVector &consultant_ids,
+                                IdVector &customer_ids, pyAi::Error &error) {
+  std::pmr::string consultants_p{batch.arena.resource()},
+      customers_p{batch.arena.resource()};
 
-  static const char *PARSE_MESSAGE = "Error parsing object",
-                    *MISSING_CONSULTANT = "Missing consultant member",
-                    *MISSING_CUSTOMER = "Missing customer member",
-                    *MISSING_VISITED_AT = "Missing visited_at member",
-                    *MISSING_COMMENT = "Missing comment member",
-                    *INVALID_CONSULTANT = "Invalid consultant name",
-                    *INVALID_CUSTOMER = "Invalid customer name",
-                    *INVALID_VISITED_AT = "Invalid visited_at format";
+  PQ_Utils::AppendArray(consultants_p, batch.consultants.strings());
+  PQ_Utils::AppendArray(customers_p, batch.customers.strings());
 
-  std::unordered_map<std::string, std::size_t> consultant_map, customer_map;
-  std::size_t consultant_count = 0, customer_count = 0;
+  const char *consultant_values[] = {consultants_p.c_str()};
+  const char *customer_values[] = {customers_p.c_str()};
 
-  for (const auto &item : payload_array) {
-    std::vector<const char *> errors;
-    errors.reserve(3);
+  for (bool retry = true;; retry = false) {
+    yai::pq::Pipeline pipeline{tx.conn};
 
-    boost::json::object object;
-    try {
-      object = item.as_object();
-    } catch (const std::exception &) {
-      errors.emplace_back(PARSE_MESSAGE);
-      bad_objects.emplace_back(std::move(object), errors);
-      continue;
-    }
+    if (pipeline.Enter())
+      return error.Set(PyExc_RuntimeError, pipeline.error());
 
-    std::string consultant;
-    try {
-      consultant = std::move(object["consultant"].as_string());
-    } catch (const std::exception &) {
-      errors.emplace_back(MISSING_CONSULTANT);
-    }
+    const std::size_t consultant_q =
+        pipeline.Push(RESOLVE_CONSULTANTS_Q, 1, consultant_values);
+    const std::size_t customer_q =
+        pipeline.Push(RESOLVE_CUSTOMERS_Q, 1, customer_values);
 
-    std::string customer;
-    try {
-      customer = std::move(object["customer"].as_string());
-    } catch (const std::exception &) {
-      errors.emplace_back(MISSING_CUSTOMER);
-    }
+    if (pipeline.Sync())
+      return error.Set(PyExc_RuntimeError, pipeline.error());
 
-    std::string visited_at;
-    try {
-      visited_at = std::move(object["visited_at"].as_string());
-    } catch (const std::exception &) {
-      errors.emplace_back(MISSING_VISITED_AT);
-    }
+    bool missing = MapIds(pipeline.result(consultant_q), batch.consultants,
+                          consultant_ids, tx.consultants);
+    missing = MapIds(pipeline.result(customer_q), batch.customers,
+                     customer_ids, tx.customers) ||
+              missing;
 
-    std::string_view comment_raw;
-    try {
-      comment_raw = object["comment"].as_string();
-    } catch (const std::exception &) {
-      errors.emplace_back(MISSING_COMMENT);
-    }
+    if (!missing || !retry)
+      return false;
+  }
+}
 
-    if (ImportJSON_Utils::ValidateName(consultant)) {
-      errors.emplace_back(INVALID_CONSULTANT);
-    }
+// Resolves the names of a batch and copies its rows in.
+inline static bool Flush(Transaction &tx, Batch &batch,
+                         Import_Utils::Outcome &outcome) {
+  if (batch.rows.empty())
+    return false;
 
-    if (ImportJSON_Utils::ValidateName(customer)) {
-      errors.emplace_back(INVALID_CUSTOMER);
-    }
+  IdVector consultant_ids = batch.arena.MakeVector<std::int32_t>(),
+           customer_ids = batch.arena.MakeVector<std::int32_t>();
 
-    if (ImportJSON_Utils::ValidateVisitedAt(visited_at)) {
-      errors.emplace_back(INVALID_VISITED_AT);
-    }
+  if (ResolveNames(tx, batch, consultant_ids, customer_ids, outcome.error))
+    return true;
+
+  using Import_Utils::Booking;
+
+  yai::Arena::Vector<Booking> bookings = batch.arena.MakeVector<Booking>();
+  bookings.reserve(batch.rows.size());
 
-    if (!errors.empty()) {
-      bad_objects.emplace_back(std::move(object), std::move(errors));
+  for (const BookRow &row : batch.rows) {
+    const std::int32_t consultant_id = consultant_ids[row.consultant];
+    const std::int32_t customer_id = customer_ids[row.customer];
+
+    if (consultant_id < 0 || customer_id < 0) {
+      outcome.rejected.push_back(
+          {row.row,
+           consultant_id < 0 ? "Unknown consultant" : "Unknown customer"});
       continue;
     }
 
-    std::size_t consultant_value = ImportJSON_Utils::GetMapCount(
-        consultant_map, consultant, consultant_count);
+    bookings.push_back(
+        {consultant_id, customer_id, row.visited_at, row.comment});
+  }
 
-    std::size_t customer_value =
-        ImportJSON_Utils::GetMapCount(customer_map, customer, customer_count);
+  tx.copied += bookings.size();
 
-    const std::string comment = ImportJSON_Utils::CleanComment(comment_raw);
+  return !bookings.empty() &&
+         Import_Utils::CopyBookings(tx.conn, bookings, outcome.error);
+}
 
-    bulk_objects.emplace_back(consultant_value, customer_value,
-                              std::move(visited_at), std::move(comment));
+// Validates one element of the array and stages it in the batch.
+inline static void Stage(const boost::json::value &item, std::uint32_t row,
+                         Batch &batch,
+                         std::vector<Import_Utils::RowError> &errors) {
+  const boost::json::object *object = item.if_object();
+  if (!object) {
+    errors.push_back({row, "Expected an object"});
+    return;
   }
 
-  if (bulk_objects.empty()) {
-    PyErr_SetString(PyExc_ValueError, "No valid objects found");
-    return nullptr;
-  }
+  const std::size_t previous_errors = errors.size();
+  std::string_view consultant, customer, visited_at, comment;
+  std::optional<yai::time::PgTimestamp> timestamp;
 
-  PGconn *conn = PQconnectdb(abi_settings.conninfo);
+  if (!GetString(*object, "consultant", consultant))
+    errors.push_back({row, "Missing consultant"});
+  else if (!yai::validate::Name(consultant))
+    errors.push_back({row, "Invalid consultant name"});
 
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PyErr_SetString(PyExc_ConnectionError, PQerrorMessage(conn));
-    PQfinish(conn);
-    return nullptr;
-  }
+  if (!GetString(*object, "customer", customer))
+    errors.push_back({row, "Missing customer"});
+  else if (!yai::validate::Name(customer))
+    errors.push_back({row, "Invalid customer name"});
 
-  if (ImportJSON_Utils::InsertConsultants(conn, consultant_map)) {
-    PyErr_SetString(PyExc_RuntimeError, "Error inserting consultants");
-    return nullptr;
-  }
+  if (!GetString(*object, "visited_at", visited_at))
+    errors.push_back({row, "Missing visited_at"});
+  else if (!(timestamp = yai::time::ParseTimestamp(visited_at)))
+    errors.push_back({row, "Invalid visited_at format"});
 
-  std::ostringstream oss;
-  oss << "INSERT INTO booking (consultant, customer, visited_at, comment) "
-         "VALUES ";
+  if (!GetString(*object, "comment", comment))
+    errors.push_back({row, "Missing comment"});
 
-  auto it = bulk_objects.begin();
+  if (errors.size() != previous_errors)
+    return;
 
-  {
-    const auto &[consultant, customer, visited_at, comment] = *it;
-    oss << "('" << consultant << "', '" << customer << "', '" << visited_at
-        << "', '" << comment << "')";
-    ++it;
-  }
+  batch.rows.push_back({row, batch.consultants.Intern(consultant),
+                        batch.customers.Intern(customer), *timestamp,
+                        batch.arena.Copy(comment)});
+}
 
-  while (it != bulk_objects.end()) {
-    const auto &[consultant, customer, visited_at, comment] = *it;
+inline static const char *SkipSpace(const char *p, const char *end) {
+  while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    ++p;
+  return p;
+}
 
-    oss << ", ('" << consultant << "', '" << customer << "', '" << visited_at
-        << "', '" << comment << "')";
-    ++it;
-  }
+// Walks the top-level array and parses one element at a time into a small
+// resource that is reset after each, flushing every BATCH_ROWS rows.
+inline static bool Parse(std::string_view buffer, Transaction &tx,
+                         Import_Utils::Outcome &outcome) {
+  const char *p = buffer.data();
+  const char *const end = p + buffer.size();
 
-  PGresult *res = PQexec(conn, oss.str().c_str());
+  p = SkipSpace(p, end);
+  if (p == end || *p != '[')
+    return ArrayParseError(outcome.error, "expected an array");
 
-  if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(res));
-    PQclear(res);
-    PQfinish(conn);
-    Py_RETURN_NONE;
-  }
+  p = SkipSpace(p + 1, end);
+  bool more = p == end || *p != ']';
 
-  PQclear(res);
-  PQfinish(conn);
+  if (!more)
+    ++p;
 
-  Py_RETURN_NONE;
-}
+  std::optional<Batch> batch{std::in_place};
+  boost::json::stream_parser parser;
+  unsigned char scratch[4096];
+  boost::json::monotonic_resource resource{scratch, sizeof(scratch)};
 
-inline static void OSSAppendNames(std::ostringstream &oss,
-                                  const std::vector<std::string_view> &names) {
-  auto it = names.begin();
-  oss << "'" << *it << "'";
-  ++it;
+  for (std::uint32_t row = 0; more; ++row) {
+    boost::json::error_code ec;
 
-  while (it != names.end()) {
-    oss << ", '" << *it << "'";
-    ++it;
-  }
-}
+    parser.reset(&resource);
+    p += parser.write_some(p, static_cast<std::size_t>(end - p), ec);
 
-static PyObject *ImportCSVConsultants(PyObject *, PyObject *bytes) {
-  if (!PyBytes_Check(bytes)) {
-    PyErr_SetString(PyExc_TypeError, "Expected a bytes");
-    return nullptr;
-  }
+    if (!ec && !parser.done())
+      parser.finish(ec);
 
-  Py_ssize_t buffer_ssize = PyBytes_Size(bytes);
-  if (buffer_ssize < 0) {
-    PyErr_SetString(PyExc_TypeError, "Empty bytes");
-    return nullptr;
-  }
-  std::size_t buffer_size = static_cast<std::size_t>(buffer_ssize);
+    if (ec)
+      return ArrayParseError(outcome.error, ec.message());
 
-  const char *buffer = PyBytes_AsString(bytes);
-  if (!buffer) {
-    PyErr_SetString(PyExc_TypeError, "Error getting buffer");
-    return nullptr;
-  }
+    Stage(parser.release(), row, *batch, outcome.rejected);
+    resource.release();
 
-  std::vector<std::string_view> names;
-  names.reserve(buffer_size / 10);
+    p = SkipSpace(p, end);
+    if (p == end || (*p != ',' && *p != ']'))
+      return ArrayParseError(outcome.error, "expected ',' or ']'");
+
+    more = *p++ == ',';
 
-  std::size_t start = 0;
-  for (std::size_t i = 0; i < buffer_size; ++i) {
-    if (buffer[i] == '\n' || buffer[i] == '\0') {
-      names.emplace_back(buffer + start, i - start);
-      start = i + 1;
+    if (batch->rows.size() >= BATCH_ROWS) {
+      if (Flush(tx, *batch, outcome))
+        return true;
+      batch.emplace();
     }
   }
 
-  std::ostringstream oss;
-  oss << "INSERT INTO yai_booking_consultant (name) SELECT unnest(ARRAY[ ";
-  OSSAppendNames(oss, names);
-  oss << "]) WHERE NOT EXISTS (SELECT 1 FROM yai_booking_consultant WHERE "
-         "name = ANY(ARRAY[ ";
-  OSSAppendNames(oss, names);
-  oss << "]))";
-
-  PGconn *conn = PQconnectdb(abi_settings.conninfo);
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PyErr_SetString(PyExc_ConnectionError, PQerrorMessage(conn));
-    PQfinish(conn);
-    return nullptr;
-  }
+  if (SkipSpace(p, end) != end)
+    return ArrayParseError(outcome.error, "unexpected data after the array");
 
-  PGresult *res = PQexec(conn, oss.str().c_str());
+  return Flush(tx, *batch, outcome);
+}
 
-  if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(res));
-    PQclear(res);
+// One transaction, so a syntax error or a failed batch leaves nothing
+// behind, not even the names of the batches before it.
+inline static void Import(const pyAi::ABISettings &settings,
+                          std::string_view buffer,
+                          Import_Utils::Outcome &outcome) {
+  PGconn *conn = Import_Utils::Connect(settings, outcome.error);
+  if (!conn)
+    return;
+
+  Transaction tx{conn};
+
+  // Closing the connection rolls back whatever failed.
+  if (PQ_Utils::Exec(conn, "BEGIN", outcome.error) ||
+      Parse(buffer, tx, outcome) ||
+      PQ_Utils::Exec(conn, "COMMIT", outcome.error)) {
     PQfinish(conn);
-    return nullptr;
+    return;
   }
 
-  PQclear(res);
   PQfinish(conn);
 
-  Py_RETURN_NONE;
+  yai::dict::Cache &cache = yai::dict::Cache::Instance();
+  tx.consultants.ForEach([&](const std::string &name, std::int32_t id) {
+    cache.consultants().Put(id, name);
+  });
+  tx.customers.ForEach([&](const std::string &name, std::int32_t id) {
+    cache.customers().Put(id, name);
+  });
+
+  std::vector<Import_Utils::RowError> &errors = outcome.rejected;
+
+  if (!tx.copied && errors.empty())
+    outcome.error.Set(PyExc_ValueError, "No valid objects found");
+
+  std::ranges::stable_sort(errors, {}, &Import_Utils::RowError::row);
 }
 
-static PyObject *ImportCSVCustomers(PyObject *, PyObject *bytes) {
-  if (!PyBytes_Check(bytes)) {
-    PyErr_SetString(PyExc_TypeError, "Expected a bytes");
-    return nullptr;
-  }
+template <class Source> using Task = Import_Utils::RowsTask<Source, Import>;
 
-  Py_ssize_t buffer_ssize = PyBytes_Size(bytes);
-  if (buffer_ssize < 0) {
-    PyErr_SetString(PyExc_TypeError, "Empty bytes");
-    return nullptr;
-  }
-  std::size_t buffer_size = static_cast<std::size_t>(buffer_ssize);
+} // namespace ImportJSON_Utils
 
-  const char *buffer = PyBytes_AsString(bytes);
-  if (!buffer) {
-    PyErr_SetString(PyExc_TypeError, "Error getting buffer");
-    return nullptr;
+namespace ImportCSVNames_Utils {
+
+// One name per line, with surrounding blanks and CR removed; blank lines and
+// names repeated in the file are dropped.
+inline static bool SplitNames(std::string_view buffer,
+                              std::vector<std::string_view> &names,
+                              pyAi::Error &error) {
+  // Both grow with the names found: sized from the buffer, they would take
+  // several times the size of a mapped file before the first name.
+  yai::FlatSet<std::string_view> seen;
+
+  while (!buffer.empty()) {
+    std::size_t end = buffer.find_first_of(std::string_view{"\n\0", 2});
+    if (end == std::string_view::npos)
+      end = buffer.size();
+
+    std::string_view name = buffer.substr(0, end);
+    buffer.remove_prefix(std::min(end + 1, buffer.size()));
+
+    const std::size_t first = name.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos)
+      continue;
+    name = name.substr(first, name.find_last_not_of(" \t\r") - first + 1);
+
+    if (!yai::validate::Utf8(name))
+      return error.Set(PyExc_ValueError, "Invalid UTF-8 in name");
+
+    if (seen.Insert(name))
+      names.push_back(name);
   }
 
+  return false;
+}
+
+inline static bool Import(const pyAi::ABISettings &settings,
+                          std::string_view buffer, const char *query,
+                          yai::dict::Dictionary &dictionary,
+                          pyAi::Error &error) {
   std::vector<std::string_view> names;
-  names.reserve(buffer_size / 10);
+  if (SplitNames(buffer, names, error))
+    return true;
 
-  std::size_t start = 0;
-  for (std::size_t i = 0; i < buffer_size; ++i) {
-    if (buffer[i] == '\n' || buffer[i] == '\0') {
-      names.emplace_back(buffer + start, i - start);
-      start = i + 1;
-    }
-  }
+  if (names.empty())
+    return error.Set(PyExc_ValueError, "No names found");
 
-  std::ostringstream oss;
-  oss << "INSERT INTO yai_booking_customer (name) SELECT unnest(ARRAY[ ";
-  OSSAppendNames(oss, names);
-  oss << "]) WHERE NOT EXISTS (SELECT 1 FROM yai_booking_customer WHERE "
-         "name = ANY(ARRAY[ ";
-  OSSAppendNames(oss, names);
-  oss << "]))";
-
-  PGconn *conn = PQconnectdb(abi_settings.conninfo);
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PyErr_SetString(PyExc_ConnectionError, PQerrorMessage(conn));
-    PQfinish(conn);
-    return nullptr;
-  }
+  std::string literal;
+  PQ_Utils::AppendArray(literal, names);
+  const char *values[] = {literal.c_str()};
 
-  PGresult *res = PQexec(conn, oss.str().c_str());
+  PGconn *conn = Import_Utils::Connect(settings, error);
+  if (!conn)
+    return true;
+
+  PGresult *res =
+      PQexecParams(conn, query, 1, nullptr, values, nullptr, nullptr, 0);
 
-  if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(res));
+  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+    error.Set(PyExc_RuntimeError, PQresultErrorMessage(res));
     PQclear(res);
     PQfinish(conn);
-    return nullptr;
+    return true;
   }
 
+  // Only new rows come back; existing ones are already in the dictionary.
+  PQ_Utils::PutIds(res, dictionary);
+
   PQclear(res);
   PQfinish(conn);
 
-  Py_RETURN_NONE;
+  return false;
 }
 
-namespace ImportCSVBooking_Utils {
+static constexpr const char *INSERT_CONSULTANTS_Q =
+    "INSERT INTO yai_booking_consultant (name) "
+    "SELECT unnest($1::varchar[]) ON CONFLICT (name) DO NOTHING "
+    "RETURNING id, name";
 
-inline static bool LoadConsultants(
-    PGconn *conn,
-    std::unordered_map<std::string_view, std::string_view> &consultant_map,
-    PGresult *&pgres) {
-  consultant_map.reserve(128);
+static constexpr const char *INSERT_CUSTOMERS_Q =
+    "INSERT INTO yai_booking_customer (name) "
+    "SELECT unnest($1::varchar[]) ON CONFLICT (name) DO NOTHING "
+    "RETURNING id, name";
 
-  pgres = PQexec(conn, "SELECT id, name FROM yai_booking_consultant LIMIT 128");
+template <class Source, bool CONSULTANTS> struct Task {
+  std::shared_ptr<const pyAi::ABISettings> settings;
+  Source source;
+  pyAi::Error error;
 
-  if (PQresultStatus(pgres) != PGRES_TUPLES_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(pgres));
-    return true;
+  bool Prepare(PyObject *arg) { return source.Get(arg); }
+
+  void Run(pyAi::ThreadState &) {
+    yai::dict::Cache &cache = yai::dict::Cache::Instance();
+
+    if constexpr (CONSULTANTS)
+      Import(*settings, source.view(), INSERT_CONSULTANTS_Q,
+             cache.consultants(), error);
+    else
+      Import(*settings, source.view(), INSERT_CUSTOMERS_Q, cache.customers(),
+             error);
   }
 
-  const int rows = PQntuples(pgres);
+  PyObject *Finish() {
+    if (error)
+      return error.Raise();
 
-  for (int i = 0; i < rows; ++i)
-    consultant_map.emplace(PQgetvalue(pgres, i, 1), PQgetvalue(pgres, i, 0));
+    Py_RETURN_NONE;
+  }
+};
 
-  return false;
-}
+} // namespace ImportCSVNames_Utils
 
-inline static bool LoadCustomers(
-    PGconn *conn,
-    std::unordered_map<std::string_view, std::string_view> &customer_map,
-    PGresult *&pgres) {
-  customer_map.reserve(256);
+namespace ImportCSVBooking_Utils {
 
-  pgres = PQexec(conn, "SELECT id, name FROM yai_booking_customer LIMIT 256");
+static constexpr const char *CONSULTANT_ID_Q =
+    "SELECT id, name FROM yai_booking_consultant WHERE name = $1";
 
-  if (PQresultStatus(pgres) != PGRES_TUPLES_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(pgres));
-    return true;
+static constexpr const char *CUSTOMER_ID_Q =
+    "SELECT id, name FROM yai_booking_customer WHERE name = $1";
+
+// Looks names up in the shared cache. Names imported moments ago may still
+// be in flight on the notification channel, so the first miss catches up.
+// Another process may have imported a name whose notification has not even
+// arrived yet, so a miss after that is looked up in the database, once per
+// name, and the cache updated.
+class NameResolver {
+public:
+  NameResolver(yai::dict::Cache &cache, PGconn *conn, pyAi::Error &error)
+      : cache_{cache}, conn_{conn}, error_{error} {}
+
+  std::optional<std::int32_t> Consultant(std::string_view name) {
+    return Find(cache_.consultants(), CONSULTANT_ID_Q, name);
   }
 
-  const int rows = PQntuples(pgres);
+  std::optional<std::int32_t> Customer(std::string_view name) {
+    return Find(cache_.customers(), CUSTOMER_ID_Q, name);
+  }
 
-  for (int i = 0; i < rows; ++i)
-    customer_map.emplace(PQgetvalue(pgres, i, 1), PQgetvalue(pgres, i, 0));
+private:
+  std::optional<std::int32_t> Find(yai::dict::Dictionary &dictionary,
+                                   const char *id_q, std::string_view name) {
+    std::optional<std::int32_t> id = dictionary.Find(name);
 
-  return false;
-}
+    if (!id && !caught_up_) {
+      cache_.Catchup();
+      caught_up_ = true;
+      id = dictionary.Find(name);
+    }
 
-} // namespace ImportCSVBooking_Utils
+    if (id || error_ || missing_.Contains(name) || !yai::validate::Utf8(name))
+      return id;
 
-static PyObject *ImportCSVBooking(PyObject *, PyObject *bytes) {
-  if (!PyBytes_Check(bytes)) {
-    PyErr_SetString(PyExc_TypeError, "Expected a bytes");
-    return nullptr;
-  }
+    const std::string value{name};
+    const char *values[] = {value.c_str()};
 
-  Py_ssize_t buffer_ssize = PyBytes_Size(bytes);
-  if (buffer_ssize < 0) {
-    PyErr_SetString(PyExc_TypeError, "Empty bytes");
-    return nullptr;
-  }
+    PGresult *res =
+        PQexecParams(conn_, id_q, 1, nullptr, values, nullptr, nullptr, 0);
 
-  const char *buffer = PyBytes_AsString(bytes);
-  if (!buffer) {
-    PyErr_SetString(PyExc_TypeError, "Error getting buffer");
-    return nullptr;
-  }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+      error_.Set(PyExc_RuntimeError, PQresultErrorMessage(res));
+    } else if (PQntuples(res)) {
+      PQ_Utils::PutIds(res, dictionary);
+      id = std::stoi(PQgetvalue(res, 0, 0));
+    } else {
+      missing_.Insert(name);
+    }
 
-  PGconn *conn = PQconnectdb(abi_settings.conninfo);
+    PQclear(res);
 
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PyErr_SetString(PyExc_ConnectionError, PQerrorMessage(conn));
-    PQfinish(conn);
-    return nullptr;
+    return id;
   }
 
-  std::unordered_map<std::string_view, std::string_view> consultant_map,
-      customer_map;
-  PGresult *consultant_pgres = nullptr, *customer_pgres = nullptr;
+  yai::dict::Cache &cache_;
+  PGconn *conn_;
+  pyAi::Error &error_;
+  bool caught_up_ = false;
 
-  if (ImportCSVBooking_Utils::LoadConsultants(conn, consultant_map,
-                                              consultant_pgres)) {
-    PQclear(consultant_pgres);
-    PQfinish(conn);
-    return nullptr;
-  }
+  // Names the database did not have either.
+  yai::FlatSet<std::string> missing_;
+};
 
-  if (ImportCSVBooking_Utils::LoadCustomers(conn, customer_map,
-                                            customer_pgres)) {
-    PQclear(consultant_pgres);
-    PQclear(customer_pgres);
-    PQfinish(conn);
-    return nullptr;
+inline static void Import(const pyAi::ABISettings &settings,
+                          std::string_view buffer,
+                          Import_Utils::Outcome &outcome) {
+  yai::dict::Cache &cache = yai::dict::Cache::Instance();
+
+  if (cache.Start(settings.conninfo.c_str())) {
+    outcome.error.Set(PyExc_ConnectionError,
+                      "Error loading dictionary cache");
+    return;
   }
 
-  std::vector<std::tuple<std::string_view, std::string_view, std::string_view,
-                         std::string_view>>
-      bulk_lines;
-  bulk_lines.reserve(512);
+  PGconn *conn = Import_Utils::Connect(settings, outcome.error);
+  if (!conn)
+    return;
+
+  std::vector<Import_Utils::Booking> bookings;
+  bookings.reserve(512);
+  std::vector<Import_Utils::RowError> &errors = outcome.rejected;
 
-  std::string_view buffer_view(buffer, static_cast<std::size_t>(buffer_ssize));
-  std::size_t pos = buffer_view.find('\n') + 1;
+  NameResolver resolver{cache, conn, outcome.error};
 
-  while (pos < buffer_view.size()) {
-    std::size_t next = buffer_view.find(',', pos);
+  std::size_t pos = buffer.find('\n') + 1;
+
+  // Rows are numbered as file lines, the header being line 1.
+  for (std::uint32_t row = 2; pos < buffer.size(); ++row) {
+    std::size_t next = buffer.find(',', pos);
     if (next == std::string_view::npos)
       break;
-    std::string_view consultant = buffer_view.substr(pos, next - pos);
+    std::string_view consultant = buffer.substr(pos, next - pos);
     pos = next + 1;
 
-    next = buffer_view.find(',', pos);
+    next = buffer.find(',', pos);
     if (next == std::string_view::npos)
       break;
-    std::string_view customer = buffer_view.substr(pos, next - pos);
+    std::string_view customer = buffer.substr(pos, next - pos);
     pos = next + 1;
 
-    next = buffer_view.find(',', pos);
+    next = buffer.find(',', pos);
     if (next == std::string_view::npos)
       break;
-    std::string_view visited_at = buffer_view.substr(pos, next - pos);
+    std::string_view visited_at = buffer.substr(pos, next - pos);
     pos = next + 1;
 
-    next = buffer_view.find('\n', pos);
+    next = buffer.find('\n', pos);
     if (next == std::string_view::npos)
       break;
-    std::string_view comment = buffer_view.substr(pos + 1, next - pos - 2);
+    std::string_view comment = buffer.substr(pos + 1, next - pos - 2);
     pos = next + 1;
 
-    std::string_view::size_type pos_quote = comment.find('\'');
-    while (pos_quote != std::string_view::npos) {
-      const_cast<char *>(comment.data())[pos_quote] = '"';
-      pos_quote = comment.find('\'', pos_quote + 1);
+    const std::optional<std::int32_t> consultant_id =
+        resolver.Consultant(consultant);
+    const std::optional<std::int32_t> customer_id =
+        consultant_id ? resolver.Customer(customer) : std::nullopt;
+
+    if (outcome.error) {
+      PQfinish(conn);
+      return;
+    }
+
+    if (!consultant_id) {
+      errors.push_back({row, "Unknown consultant"});
+      continue;
+    }
+
+    if (!customer_id) {
+      errors.push_back({row, "Unknown customer"});
+      continue;
+    }
+
+    const std::optional<yai::time::PgTimestamp> timestamp =
+        yai::time::ParseTimestamp(visited_at);
+    if (!timestamp) {
+      errors.push_back({row, "Invalid visited_at format"});
+      continue;
     }
 
-    bulk_lines.emplace_back(consultant, customer, visited_at, comment);
+    if (!yai::validate::Utf8(comment)) {
+      errors.push_back({row, "Invalid UTF-8 in comment"});
+      continue;
+    }
+
+    bookings.push_back({*consultant_id, *customer_id, *timestamp, comment});
   }
 
-  if (bulk_lines.empty()) {
-    PyErr_SetString(PyExc_ValueError, "No valid lines found");
-    return nullptr;
+  if (bookings.empty()) {
+    if (errors.empty())
+      outcome.error.Set(PyExc_ValueError, "No valid lines found");
+    PQfinish(conn);
+    return;
   }
 
-  std::ostringstream oss;
-  oss << "INSERT INTO yai_booking_book (consultant_id, customer_id, "
-         "visited_at, comment) VALUES ";
+  Import_Utils::CopyBookings(conn, bookings, outcome.error);
 
-  auto it = bulk_lines.begin();
+  PQfinish(conn);
+}
+
+template <class Source> using Task = Import_Utils::RowsTask<Source, Import>;
+
+} // namespace ImportCSVBooking_Utils
+
+namespace AiConsultantsSummary_Utils {
 
-  {
-    const auto &[consultant, customer, visited_at, comment] = *it;
-    oss << "(" << consultant_map[consultant] << ", " << customer_map[customer]
-        << ", '" << visited_at << "', '" << comment << "')";
-    ++it;
+inline static bool Query(PGconn *conn, PGresult *&res, const char *query,
+                         int n, const char *const *values,
+                         pyAi::Error &error) {
+  res = PQexecParams(conn, query, n, nullptr, values, nullptr, nullptr, 0);
+
+  if (PQresultStatus(res) != PGRES_TUPLES_OK &&
+      PQresultStatus(res) != PGRES_COMMAND_OK) {
+    error.Set(PyExc_RuntimeError, PQresultErrorMessage(res));
+    PQclear(res);
+    return true;
   }
 
-  while (it != bulk_lines.end()) {
-    const auto &[consultant, customer, visited_at, comment] = *it;
-    oss << ", (" << consultant_map[consultant] << ", " << customer_map[customer]
-        << ", '" << visited_at << "', '" << comment << "')";
-    ++it;
+  return false;
+}
+
+inline static std::string Item(PGresult *res, int row) {
+  std::ostringstream oss;
+  oss << "\t<item>\n\t\t<consultant>" << PQgetvalue(res, row, 0)
+      << "</consultant>\n\t\t<customer>" << PQgetvalue(res, row, 1)
+      << "</customer>\n\t\t<comment>" << PQgetvalue(res, row, 2)
+      << "</comment>\n\t</item>\n";
+  return oss.str();
+}
+
+// The bookings as <elements> bodies of at most chunk_bytes each. A
+// consultant's bookings stay in one chunk unless they alone are larger, so
+// that a chunk changes only when its consultants' bookings do.
+inline static std::vector<std::string> Partition(PGresult *res,
+                                                 std::size_t chunk_bytes) {
+  const int rows = PQntuples(res);
+
+  // Consultants in order of first booking.
+  yai::FlatMap<std::string_view, std::size_t> index;
+  std::vector<std::vector<int>> groups;
+
+  for (int i = 0; i < rows; ++i) {
+    const std::string_view consultant = PQgetvalue(res, i, 0);
+    auto [group, inserted] = index.Emplace(consultant, groups.size());
+    if (inserted)
+      groups.emplace_back();
+    groups[*group].push_back(i);
   }
 
-  PGresult *booking_pgres = PQexec(conn, oss.str().c_str());
+  std::vector<std::string> chunks;
+  std::string chunk;
 
-  if (PQresultStatus(booking_pgres) != PGRES_COMMAND_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(booking_pgres));
-    PQclear(booking_pgres);
-    PQclear(consultant_pgres);
-    PQclear(customer_pgres);
-    PQfinish(conn);
-    return nullptr;
+  auto flush = [&] {
+    if (!chunk.empty())
+      chunks.push_back(std::move(chunk));
+    chunk.clear();
+  };
+
+  for (const std::vector<int> &group : groups) {
+    std::string items;
+    for (const int row : group)
+      items += Item(res, row);
+
+    if (chunk.size() + items.size() <= chunk_bytes) {
+      chunk += items;
+      continue;
+    }
+
+    flush();
+
+    if (items.size() <= chunk_bytes) {
+      chunk = std::move(items);
+      continue;
+    }
+
+    for (const int row : group) {
+      std::string item = Item(res, row);
+      if (chunk.size() + item.size() > chunk_bytes)
+        flush();
+      chunk += item;
+    }
   }
 
-  PQclear(booking_pgres);
-  PQclear(consultant_pgres);
-  PQclear(customer_pgres);
-  PQfinish(conn);
+  flush();
 
-  Py_RETURN_NONE;
+  return chunks;
 }
 
-static PyObject *AiConsultantsSummary(PyObject *) {
-  PGconn *conn = PQconnectdb(abi_settings.conninfo);
+// Summarizes each chunk on its own, with at most summary_concurrency
+// completions in flight. Runs on threads of its own: the calling thread may
+// be an executor worker already.
+inline static bool Map(const pyAi::ABISettings &settings,
+                       std::string_view message,
+                       const std::vector<std::string> &chunks,
+                       std::vector<std::string> &partials,
+                       pyAi::Error &error) {
+  partials.assign(chunks.size(), {});
+  std::vector<std::string> errors(chunks.size());
+  std::atomic<std::size_t> next{0};
+
+  auto work = [&] {
+    for (std::size_t i; (i = next.fetch_add(1)) < chunks.size();) {
+      yai::ai::Chat chat{settings.xai_model, {}};
+      chat.AddU(std::string{message} +
+                "Summarize only these bookings; the summary will be merged "
+                "with those of the other bookings.\n<elements>\n" +
+                chunks[i] + "</elements>\n");
+
+      if (settings.xai->Complete(chat, partials[i], errors[i]) &&
+          errors[i].empty())
+        errors[i] = "Error summarizing bookings";
+    }
+  };
 
-  if (PQstatus(conn) != CONNECTION_OK) {
-    PyErr_SetString(PyExc_ConnectionError, PQerrorMessage(conn));
-    PQfinish(conn);
-    return nullptr;
-  }
+  std::vector<std::thread> workers(
+      std::min(std::max<std::size_t>(settings.summary_concurrency, 1),
+               chunks.size()) -
+      1);
+  for (std::thread &worker : workers)
+    worker = std::thread{work};
+
+  work();
+
+  for (std::thread &worker : workers)
+    worker.join();
+
+  for (const std::string &e : errors)
+    if (!e.empty())
+      return error.Set(PyExc_RuntimeError, e);
 
-  PGresult *pgres_message =
-      PQexec(conn, "SELECT message FROM yai_booking_message LIMIT 1");
+  return false;
+}
+
+// With INCREMENTAL, only bookings not in the stored summary are sent,
+// together with the stored summary to update; with no new bookings the
+// stored summary is returned as is. Either way the result is stored as the
+// baseline for the next update.
+template <bool INCREMENTAL>
+inline static bool Summarize(const pyAi::ABISettings &settings,
+                             std::string &summary, pyAi::Error &error) {
+  PGconn *conn = Import_Utils::Connect(settings, error);
+  if (!conn)
+    return true;
 
-  if (PQresultStatus(pgres_message) != PGRES_TUPLES_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(pgres_message));
-    PQclear(pgres_message);
+  PGresult *pgres_message;
+  if (Query(conn, pgres_message,
+            "SELECT message FROM yai_booking_message LIMIT 1", 0, nullptr,
+            error)) {
     PQfinish(conn);
-    return nullptr;
+    return true;
   }
 
-  const char *message = PQgetvalue(pgres_message, 0, 0);
+  const std::string message = PQgetvalue(pgres_message, 0, 0);
+  PQclear(pgres_message);
 
-  PGresult *pgres_books =
-      PQexec(conn, "SELECT C.name, D.name, B.comment FROM yai_booking_book B "
-                   "JOIN yai_booking_consultant C ON B.consultant_id = C.id "
-                   "JOIN yai_booking_customer D ON B.customer_id = D.id");
+  yai::booking::summary::Snapshot snapshot;
+  std::string db_error;
 
-  if (PQresultStatus(pgres_books) != PGRES_TUPLES_OK) {
-    PyErr_SetString(PyExc_RuntimeError, PQresultErrorMessage(pgres_books));
-    PQclear(pgres_books);
-    PQclear(pgres_message);
+  if (yai::booking::summary::Load(conn, INCREMENTAL, snapshot, db_error)) {
     PQfinish(conn);
-    return nullptr;
+    return error.Set(PyExc_RuntimeError, db_error);
   }
 
-  const int rows = PQntuples(pgres_books);
+  if (snapshot.update && !PQntuples(snapshot.bookings)) {
+    summary = std::move(snapshot.summary);
+    PQfinish(conn);
+    return false;
+  }
+
+  const std::vector<std::string> chunks =
+      Partition(snapshot.bookings, settings.summary_chunk_bytes);
+
   std::ostringstream oss;
 
-  oss << message << "<elements>\n";
-  for (int i = 0; i < rows; ++i) {
-    oss << "\t<item>\n\t\t<consultant>" << PQgetvalue(pgres_books, i, 0)
-        << "</consultant>\n\t\t<customer>" << PQgetvalue(pgres_books, i, 1)
-        << "</customer>\n\t\t<comment>" << PQgetvalue(pgres_books, i, 2)
-        << "</comment>\n\t</item>\n";
+  oss << message;
+  if (snapshot.update)
+    oss << "<summary>\n"
+        << snapshot.summary
+        << "\n</summary>\nUpdate the summary above with these new "
+           "bookings.\n";
+
+  // Too many bookings for one prompt: map each chunk to a partial summary,
+  // then reduce the partials to one.
+  if (chunks.size() > 1) {
+    std::vector<std::string> partials;
+    if (Map(settings, message, chunks, partials, error)) {
+      PQfinish(conn);
+      return true;
+    }
+
+    oss << "Merge these partial summaries of disjoint sets of bookings.\n"
+           "<summaries>\n";
+    for (const std::string &partial : partials)
+      oss << "<summary>\n" << partial << "\n</summary>\n";
+    oss << "</summaries>\n";
+  } else {
+    oss << "<elements>\n"
+        << (chunks.empty() ? std::string{} : chunks.front())
+        << "</elements>\n";
   }
-  oss << "</elements>\n";
 
-  PQclear(pgres_books);
-  PQclear(pgres_message);
-  PQfinish(conn);
+  yai::ai::Chat chat{settings.xai_model, {}};
+  chat.AddU(oss.str());
 
-  std::unique_ptr<xai::Client> client =
-      xai::Client::Make(abi_settings.xai_api_key);
+  std::string ai_error;
+  if (settings.xai->Complete(chat, summary, ai_error)) {
+    PQfinish(conn);
+    return error.Set(PyExc_RuntimeError, ai_error);
+  }
 
-  if (!client) {
-    PyErr_SetString(PyExc_RuntimeError, "Error creating client");
-    return nullptr;
+  // Not saved when another summary was stored meanwhile; its bookings are
+  // then left for the next update.
+  bool saved;
+  if (yai::booking::summary::Save(conn, snapshot, summary, saved, db_error)) {
+    PQfinish(conn);
+    return error.Set(PyExc_RuntimeError, db_error);
   }
 
-  std::unique_ptr<xai::Messages> messages =
-      xai::Messages::Make(abi_settings.xai_model);
-  messages->AddU(oss.str());
+  PQfinish(conn);
 
-  std::unique_ptr<xai::Choices> choices = client->ChatCompletion(messages);
+  return false;
+}
 
-  if (!choices) {
-    PyErr_SetString(PyExc_RuntimeError, "Error getting choices");
-    return nullptr;
+struct Outcome {
+  std::string summary;
+  pyAi::Error error;
+};
+
+template <bool INCREMENTAL> struct Task {
+  std::shared_ptr<const pyAi::ABISettings> settings;
+  std::string summary;
+  pyAi::Error error;
+
+  bool Prepare(PyObject *) { return false; }
+
+  void Run(pyAi::ThreadState &) {
+    // A dashboard opened by many users at once runs the query and the
+    // completion once; every caller gets that summary.
+    static yai::SingleFlight<std::string, Outcome> flights;
+
+    const std::shared_ptr<const Outcome> outcome =
+        flights.Do(settings->conninfo, [&] {
+          Outcome result;
+          Summarize<INCREMENTAL>(*settings, result.summary, result.error);
+          return result;
+        });
+
+    summary = outcome->summary;
+    error = outcome->error;
   }
 
-  std::string_view res = choices->first();
+  PyObject *Finish() {
+    if (error)
+      return error.Raise();
 
-  PyObject *pyres = PyBytes_FromStringAndSize(
-      res.data(), static_cast<Py_ssize_t>(res.size()));
+    PyObject *pyres = PyBytes_FromStringAndSize(
+        summary.data(), static_cast<Py_ssize_t>(summary.size()));
 
-  if (!pyres) {
-    PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
-    return nullptr;
+    if (!pyres) {
+      PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
+      return nullptr;
+    }
+
+    return pyres;
   }
+};
 
-  return pyres;
-}
+} // namespace AiConsultantsSummary_Utils
+
+using Import_Utils::Buffer, Import_Utils::File;
 
 static PyMethodDef m_methods[] = {
-    {"ImportJSON", ImportJSON, METH_O, "Import JSON"},
-    {"ImportCSVConsultants", ImportCSVConsultants, METH_O,
+    {"ImportJSON", pyAi::Sync<ImportJSON_Utils::Task<Buffer>>, METH_O,
+     "Import JSON"},
+    {"ImportJSONAsync", pyAi::Async<ImportJSON_Utils::Task<Buffer>>, METH_O,
+     "Import JSON, awaitable"},
+    {"ImportJSONFile", pyAi::Sync<ImportJSON_Utils::Task<File>>, METH_O,
+     "Import JSON from a file"},
+    {"ImportJSONFileAsync", pyAi::Async<ImportJSON_Utils::Task<File>>, METH_O,
+     "Import JSON from a file, awaitable"},
+    {"ImportCSVConsultants",
+     pyAi::Sync<ImportCSVNames_Utils::Task<Buffer, true>>, METH_O,
      "Import Consultants from CSV"},
-    {"ImportCSVCustomers", ImportCSVCustomers, METH_O,
+    {"ImportCSVConsultantsAsync",
+     pyAi::Async<ImportCSVNames_Utils::Task<Buffer, true>>, METH_O,
+     "Import Consultants from CSV, awaitable"},
+    {"ImportCSVConsultantsFile",
+     pyAi::Sync<ImportCSVNames_Utils::Task<File, true>>, METH_O,
+     "Import Consultants from a CSV file"},
+    {"ImportCSVConsultantsFileAsync",
+     pyAi::Async<ImportCSVNames_Utils::Task<File, true>>, METH_O,
+     "Import Consultants from a CSV file, awaitable"},
+    {"ImportCSVCustomers",
+     pyAi::Sync<ImportCSVNames_Utils::Task<Buffer, false>>, METH_O,
      "Import Customers from CSV"},
-    {"ImportCSVBooking", ImportCSVBooking, METH_O, "Import Booking from CSV"},
-    {"AiConsultantsSummary", _PyCFunction_CAST(AiConsultantsSummary),
-     METH_NOARGS, "Consultants Summary"},
+    {"ImportCSVCustomersAsync",
+     pyAi::Async<ImportCSVNames_Utils::Task<Buffer, false>>, METH_O,
+     "Import Customers from CSV, awaitable"},
+    {"ImportCSVCustomersFile",
+     pyAi::Sync<ImportCSVNames_Utils::Task<File, false>>, METH_O,
+     "Import Customers from a CSV file"},
+    {"ImportCSVCustomersFileAsync",
+     pyAi::Async<ImportCSVNames_Utils::Task<File, false>>, METH_O,
+     "Import Customers from a CSV file, awaitable"},
+    {"ImportCSVBooking", pyAi::Sync<ImportCSVBooking_Utils::Task<Buffer>>,
+     METH_O, "Import Booking from CSV"},
+    {"ImportCSVBookingAsync",
+     pyAi::Async<ImportCSVBooking_Utils::Task<Buffer>>, METH_O,
+     "Import Booking from CSV, awaitable"},
+    {"ImportCSVBookingFile", pyAi::Sync<ImportCSVBooking_Utils::Task<File>>,
+     METH_O, "Import Booking from a CSV file"},
+    {"ImportCSVBookingFileAsync",
+     pyAi::Async<ImportCSVBooking_Utils::Task<File>>, METH_O,
+     "Import Booking from a CSV file, awaitable"},
+    {"AiConsultantsSummary",
+     pyAi::Sync<AiConsultantsSummary_Utils::Task<false>>, METH_NOARGS,
+     "Consultants Summary"},
+    {"AiConsultantsSummaryAsync",
+     pyAi::Async<AiConsultantsSummary_Utils::Task<false>>, METH_NOARGS,
+     "Consultants Summary, awaitable"},
+    {"AiConsultantsSummaryUpdate",
+     pyAi::Sync<AiConsultantsSummary_Utils::Task<true>>, METH_NOARGS,
+     "Consultants Summary updated with new bookings only"},
+    {"AiConsultantsSummaryUpdateAsync",
+     pyAi::Async<AiConsultantsSummary_Utils::Task<true>>, METH_NOARGS,
+     "Consultants Summary updated with new bookings only, awaitable"},
+    {"CacheStats", pyAi::CacheStats, METH_NOARGS, "AI response cache stats"},
+    {"SchedulerStats", pyAi::SchedulerStats, METH_NOARGS,
+     "AI call scheduler stats"},
     {nullptr, nullptr, 0, nullptr}};
 
+static PyModuleDef_Slot m_slots[] = {
+    {Py_mod_exec, reinterpret_cast<void *>(pyAi::ExecModule)},
+#if PY_VERSION_HEX >= 0x030C0000
+    // The caches, scheduler and executor are process-wide.
+    {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_NOT_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, nullptr}};
+
 static struct PyModuleDef pymoduledef = {PyModuleDef_HEAD_INIT,
                                          "yai_booking_abi",
                                          "yAI Booking ABI Module",
-                                         -1,
+                                         sizeof(pyAi::ModuleState),
                                          m_methods,
+                                         m_slots,
                                          nullptr,
                                          nullptr,
-                                         nullptr,
-                                         nullptr};
+                                         pyAi::FreeModule};
 
 PyMODINIT_FUNC PyInit_yai_booking_abi(void) {
-  if (pyAi::InitSettings(abi_settings))
-    return nullptr;
-  return PyModule_Create(&pymoduledef);
+  return PyModuleDef_Init(&pymoduledef);
 }
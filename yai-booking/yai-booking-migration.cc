@@ -12,6 +12,10 @@ BEGIN
     name VARCHAR(255) NOT NULL
   );
 
+  CREATE UNIQUE INDEX idx_yai_booking_consultant_name ON yai_booking_consultant (name);
+
+  CREATE UNIQUE INDEX idx_yai_booking_customer_name ON yai_booking_customer (name);
+
   CREATE TABLE yai_booking_book (
     id SERIAL PRIMARY KEY,
     consultant_id INT NOT NULL,
@@ -19,17 +23,58 @@ BEGIN
     visited_at TIMESTAMP NOT NULL,
     comment TEXT NOT NULL,
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    summarized BOOLEAN NOT NULL DEFAULT FALSE,
     FOREIGN KEY (consultant_id) REFERENCES yai_booking_consultant (id),
     FOREIGN KEY (customer_id) REFERENCES yai_booking_customer (id)
   );
 
   CREATE INDEX idx_yai_booking_book_created_at ON yai_booking_book USING btree (created_at);
 
+  CREATE INDEX idx_yai_booking_book_unsummarized ON yai_booking_book (id) WHERE NOT summarized;
+
+  CREATE FUNCTION yai_booking_dict_notify() RETURNS trigger AS $f$
+  BEGIN
+    IF TG_OP = 'TRUNCATE' THEN
+      PERFORM pg_notify('yai_booking_dict', TG_TABLE_NAME || ',' || TG_OP);
+      RETURN NULL;
+    ELSIF TG_OP = 'DELETE' THEN
+      PERFORM pg_notify('yai_booking_dict',
+        TG_TABLE_NAME || ',' || TG_OP || ',' || OLD.id || ',' || OLD.name);
+      RETURN OLD;
+    END IF;
+    PERFORM pg_notify('yai_booking_dict',
+      TG_TABLE_NAME || ',' || TG_OP || ',' || NEW.id || ',' || NEW.name);
+    RETURN NEW;
+  END $f$ LANGUAGE plpgsql;
+
+  CREATE TRIGGER yai_booking_consultant_dict
+    AFTER INSERT OR UPDATE OR DELETE ON yai_booking_consultant
+    FOR EACH ROW EXECUTE FUNCTION yai_booking_dict_notify();
+
+  CREATE TRIGGER yai_booking_consultant_dict_truncate
+    AFTER TRUNCATE ON yai_booking_consultant
+    FOR EACH STATEMENT EXECUTE FUNCTION yai_booking_dict_notify();
+
+  CREATE TRIGGER yai_booking_customer_dict
+    AFTER INSERT OR UPDATE OR DELETE ON yai_booking_customer
+    FOR EACH ROW EXECUTE FUNCTION yai_booking_dict_notify();
+
+  CREATE TRIGGER yai_booking_customer_dict_truncate
+    AFTER TRUNCATE ON yai_booking_customer
+    FOR EACH STATEMENT EXECUTE FUNCTION yai_booking_dict_notify();
+
   CREATE TABLE yai_booking_message(
     id SERIAL PRIMARY KEY,
     message TEXT NOT NULL,
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
   );
+
+  CREATE TABLE yai_booking_summary (
+    id SMALLINT PRIMARY KEY DEFAULT 1 CHECK (id = 1),
+    summary TEXT NOT NULL,
+    version BIGINT NOT NULL,
+    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+  );
 END $$;
 )";
 
@@ -39,6 +84,7 @@ BEGIN
   DELETE FROM yai_booking_customer;
   DELETE FROM yai_booking_consultant;
   DELETE FROM yai_booking_message;
+  DELETE FROM yai_booking_summary;
 END $$;)";
 
 static const char *fixtures_q = R"(DO $$
@@ -61,6 +107,8 @@ BEGIN
   DROP TABLE IF EXISTS yai_booking_customer CASCADE;
   DROP TABLE IF EXISTS yai_booking_consultant CASCADE;
   DROP TABLE IF EXISTS yai_booking_message CASCADE;
+  DROP TABLE IF EXISTS yai_booking_summary CASCADE;
+  DROP FUNCTION IF EXISTS yai_booking_dict_notify();
 END $$;)";
 
 int main(int argc, char *argv[]) {
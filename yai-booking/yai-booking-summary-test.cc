@@ -0,0 +1,194 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <libpq-fe.h>
+
+#include "yai-booking-summary.hpp"
+
+// Runs the summary bookkeeping against the database in YAI_TEST_CONNINFO,
+// in a schema of its own; skipped without it. A booking committed after a
+// summary ran, however old its created_at, must reach the next one.
+
+namespace {
+
+namespace summary = yai::booking::summary;
+
+static constexpr int SKIP = 77;
+
+static constexpr const char *SCHEMA_Q = R"(
+  DROP SCHEMA IF EXISTS yai_summary_test CASCADE;
+  CREATE SCHEMA yai_summary_test;
+  SET search_path TO yai_summary_test;
+
+  CREATE TABLE yai_booking_consultant (id SERIAL PRIMARY KEY, name TEXT);
+  CREATE TABLE yai_booking_customer (id SERIAL PRIMARY KEY, name TEXT);
+
+  CREATE TABLE yai_booking_book (
+    id SERIAL PRIMARY KEY,
+    consultant_id INT NOT NULL REFERENCES yai_booking_consultant (id),
+    customer_id INT NOT NULL REFERENCES yai_booking_customer (id),
+    comment TEXT NOT NULL,
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    summarized BOOLEAN NOT NULL DEFAULT FALSE
+  );
+
+  CREATE TABLE yai_booking_summary (
+    id SMALLINT PRIMARY KEY DEFAULT 1 CHECK (id = 1),
+    summary TEXT NOT NULL,
+    version BIGINT NOT NULL,
+    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+  );
+
+  INSERT INTO yai_booking_consultant (name) VALUES ('Bruce Wayne');
+  INSERT INTO yai_booking_customer (name) VALUES ('Tony Stark');
+)";
+
+static unsigned failures = 0;
+
+static void Check(bool ok, std::string_view what) {
+  if (ok)
+    return;
+
+  ++failures;
+  std::cerr << "FAIL " << what << std::endl;
+}
+
+static bool Exec(PGconn *conn, const char *query) {
+  PGresult *res = PQexec(conn, query);
+  const bool failed = PQresultStatus(res) != PGRES_COMMAND_OK &&
+                      PQresultStatus(res) != PGRES_TUPLES_OK;
+
+  if (failed)
+    std::cerr << query << ": " << PQresultErrorMessage(res);
+
+  PQclear(res);
+
+  return failed;
+}
+
+static PGconn *Connect(const char *conninfo) {
+  PGconn *conn = PQconnectdb(conninfo);
+
+  if (PQstatus(conn) != CONNECTION_OK) {
+    std::cerr << PQerrorMessage(conn);
+    PQfinish(conn);
+    return nullptr;
+  }
+
+  return conn;
+}
+
+static void Book(PGconn *conn, std::string_view comment) {
+  const std::string query =
+      "INSERT INTO yai_booking_book (consultant_id, customer_id, comment) "
+      "VALUES (1, 1, '" +
+      std::string{comment} + "')";
+
+  Check(!Exec(conn, query.c_str()), "insert booking");
+}
+
+// The comments of the bookings a summary would take in next, in order.
+static std::string Pending(PGconn *conn, bool incremental) {
+  summary::Snapshot snapshot;
+  std::string error, comments;
+
+  Check(!summary::Load(conn, incremental, snapshot, error), "load");
+
+  for (int i = 0; snapshot.bookings && i < PQntuples(snapshot.bookings); ++i)
+    comments.append(PQgetvalue(snapshot.bookings, i, 2)).push_back(' ');
+
+  return comments;
+}
+
+// Loads and saves a summary named text; returns the bookings it covered.
+static std::string Summarize(PGconn *conn, const std::string &text) {
+  summary::Snapshot snapshot;
+  std::string error, comments;
+  bool saved = false;
+
+  Check(!summary::Load(conn, true, snapshot, error), "load");
+  Check(!summary::Save(conn, snapshot, text, saved, error), "save");
+  Check(saved, "saved");
+
+  for (int i = 0; i < PQntuples(snapshot.bookings); ++i)
+    comments.append(PQgetvalue(snapshot.bookings, i, 2)).push_back(' ');
+
+  return comments;
+}
+
+static void CommitOrder(PGconn *conn, PGconn *writer) {
+  Book(conn, "a");
+  Check(Summarize(conn, "S1") == "a ", "first summary takes every booking");
+
+  // b gets the older created_at but commits after the summary that took c.
+  Check(!Exec(writer, "BEGIN"), "begin");
+  Book(writer, "b");
+  Book(conn, "c");
+
+  Check(Summarize(conn, "S2") == "c ", "uncommitted booking not taken");
+
+  Check(!Exec(writer, "COMMIT"), "commit");
+
+  Check(Summarize(conn, "S3") == "b ", "late commit reaches the next summary");
+  Check(Pending(conn, true).empty(), "nothing left");
+  Check(Pending(conn, false) == "a b c ", "full summary takes every booking");
+}
+
+static void Conflict(PGconn *conn) {
+  Book(conn, "d");
+
+  summary::Snapshot first, second;
+  std::string error;
+  bool saved = false;
+
+  Check(!summary::Load(conn, true, first, error), "load first");
+  Check(!summary::Load(conn, true, second, error), "load second");
+
+  Check(!summary::Save(conn, first, "S4", saved, error) && saved,
+        "first save");
+  Check(!summary::Save(conn, second, "S5", saved, error) && !saved,
+        "stale save refused");
+
+  Book(conn, "e");
+
+  summary::Snapshot after;
+  Check(!summary::Load(conn, true, after, error) && after.summary == "S4",
+        "stale summary not stored");
+  Check(Pending(conn, true) == "e ", "only the new booking pending");
+}
+
+} // namespace
+
+int main() {
+  const char *conninfo = std::getenv("YAI_TEST_CONNINFO");
+  if (!conninfo) {
+    std::cerr << "YAI_TEST_CONNINFO not set, skipping" << std::endl;
+    return SKIP;
+  }
+
+  PGconn *conn = Connect(conninfo);
+  PGconn *writer = conn ? Connect(conninfo) : nullptr;
+
+  if (!writer || Exec(conn, SCHEMA_Q) ||
+      Exec(writer, "SET search_path TO yai_summary_test")) {
+    PQfinish(conn);
+    PQfinish(writer);
+    return EXIT_FAILURE;
+  }
+
+  CommitOrder(conn, writer);
+  Conflict(conn);
+
+  Exec(conn, "DROP SCHEMA yai_summary_test CASCADE");
+  PQfinish(writer);
+  PQfinish(conn);
+
+  if (failures) {
+    std::cerr << failures << " failures" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
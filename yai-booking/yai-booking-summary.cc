@@ -0,0 +1,136 @@
+#include "yai-booking-summary.hpp"
+
+namespace yai::booking::summary {
+
+namespace {
+
+static constexpr const char *SUMMARY_Q =
+    "SELECT summary, version FROM yai_booking_summary";
+
+// NULL created_at sorts first; the id keeps the order of one COPY batch.
+static constexpr const char *BOOKINGS_Q =
+    "SELECT C.name, D.name, B.comment, B.id "
+    "FROM yai_booking_book B "
+    "JOIN yai_booking_consultant C ON B.consultant_id = C.id "
+    "JOIN yai_booking_customer D ON B.customer_id = D.id "
+    "ORDER BY B.created_at NULLS FIRST, B.id";
+
+// Served by idx_yai_booking_book_unsummarized.
+static constexpr const char *NEW_BOOKINGS_Q =
+    "SELECT C.name, D.name, B.comment, B.id "
+    "FROM yai_booking_book B "
+    "JOIN yai_booking_consultant C ON B.consultant_id = C.id "
+    "JOIN yai_booking_customer D ON B.customer_id = D.id "
+    "WHERE NOT B.summarized "
+    "ORDER BY B.id";
+
+// Returns no row when the stored version is no longer $2.
+static constexpr const char *SAVE_SUMMARY_Q =
+    "INSERT INTO yai_booking_summary (id, summary, version) "
+    "VALUES (1, $1, 1) ON CONFLICT (id) DO UPDATE SET "
+    "summary = EXCLUDED.summary, version = yai_booking_summary.version + 1, "
+    "updated_at = CURRENT_TIMESTAMP "
+    "WHERE yai_booking_summary.version = $2::bigint "
+    "RETURNING version";
+
+static constexpr const char *MARK_Q =
+    "UPDATE yai_booking_book SET summarized = TRUE "
+    "WHERE id = ANY($1::int[]) AND NOT summarized";
+
+static bool Exec(PGconn *conn, PGresult *&res, const char *query, int n,
+                 const char *const *values, std::string &error) {
+  res = PQexecParams(conn, query, n, nullptr, values, nullptr, nullptr, 0);
+
+  if (PQresultStatus(res) != PGRES_TUPLES_OK &&
+      PQresultStatus(res) != PGRES_COMMAND_OK) {
+    error = PQresultErrorMessage(res);
+    PQclear(res);
+    res = nullptr;
+    return true;
+  }
+
+  return false;
+}
+
+static bool Exec(PGconn *conn, const char *query, std::string &error) {
+  PGresult *res;
+  if (Exec(conn, res, query, 0, nullptr, error))
+    return true;
+
+  PQclear(res);
+  return false;
+}
+
+// The ids of the snapshot's bookings as an int[] literal.
+static std::string Ids(const PGresult *bookings) {
+  std::string ids{"{"};
+  const int rows = PQntuples(bookings);
+
+  for (int i = 0; i < rows; ++i) {
+    if (i)
+      ids.push_back(',');
+    ids.append(PQgetvalue(bookings, i, 3));
+  }
+
+  ids.push_back('}');
+
+  return ids;
+}
+
+} // namespace
+
+bool Load(PGconn *conn, bool incremental, Snapshot &snapshot,
+          std::string &error) {
+  PGresult *res;
+  if (Exec(conn, res, SUMMARY_Q, 0, nullptr, error))
+    return true;
+
+  if (PQntuples(res)) {
+    snapshot.summary = PQgetvalue(res, 0, 0);
+    snapshot.version = std::stoll(PQgetvalue(res, 0, 1));
+    snapshot.update = incremental;
+  }
+
+  PQclear(res);
+
+  return Exec(conn, snapshot.bookings,
+              snapshot.update ? NEW_BOOKINGS_Q : BOOKINGS_Q, 0, nullptr,
+              error);
+}
+
+bool Save(PGconn *conn, const Snapshot &snapshot, const std::string &summary,
+          bool &saved, std::string &error) {
+  const std::string version = std::to_string(snapshot.version);
+  const std::string ids = Ids(snapshot.bookings);
+  const char *save_values[] = {summary.c_str(), version.c_str()};
+  const char *mark_values[] = {ids.c_str()};
+
+  if (Exec(conn, "BEGIN", error))
+    return true;
+
+  // The first error is the one reported.
+  std::string ignored;
+
+  PGresult *res;
+  if (Exec(conn, res, SAVE_SUMMARY_Q, 2, save_values, error)) {
+    Exec(conn, "ROLLBACK", ignored);
+    return true;
+  }
+
+  saved = PQntuples(res) != 0;
+  PQclear(res);
+
+  if (!saved)
+    return Exec(conn, "ROLLBACK", error);
+
+  if (Exec(conn, res, MARK_Q, 1, mark_values, error)) {
+    Exec(conn, "ROLLBACK", ignored);
+    return true;
+  }
+
+  PQclear(res);
+
+  return Exec(conn, "COMMIT", error);
+}
+
+} // namespace yai::booking::summary
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <libpq-fe.h>
+
+namespace yai::booking::summary {
+
+// The stored consultants summary and the bookings to summarize next.
+struct Snapshot {
+  std::string summary;
+
+  // Of the stored summary; 0 when none is stored.
+  std::int64_t version = 0;
+
+  // True when only the bookings not in the stored summary were loaded.
+  bool update = false;
+
+  // consultant, customer, comment and id of each booking, oldest first.
+  PGresult *bookings = nullptr;
+
+  Snapshot() = default;
+  ~Snapshot() { PQclear(bookings); }
+
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+};
+
+// With incremental and a stored summary, loads the bookings not in it yet;
+// otherwise every booking. Returns true on error.
+bool Load(PGconn *conn, bool incremental, Snapshot &snapshot,
+          std::string &error);
+
+// Stores summary as covering the snapshot's bookings and marks them
+// summarized, in one transaction. Bookings are marked as they become
+// visible, that is in commit order, so a booking committed after Load is
+// left for the next summary however old its created_at. When another
+// summary was stored since Load, neither is done and saved is false.
+bool Save(PGconn *conn, const Snapshot &snapshot, const std::string &summary,
+          bool &saved, std::string &error);
+
+} // namespace yai::booking::summary
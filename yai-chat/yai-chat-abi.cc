@@ -1,115 +1,206 @@
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <new>
 #include <pyAi.hpp>
 #include <sstream>
-#include <xai.hpp>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <yai-session.hpp>
+#include <yai-spsc.hpp>
+
+namespace Chat_Utils {
+
+using Pairs = std::vector<std::pair<std::string, std::string>>;
+
+// The request copied out of the Python arguments, so the call to xAI can run
+// without the GIL. The history comes either from the hist list or, when a
+// session id is passed instead, from the native session store.
+struct Prompt {
+  Pairs history, scope;
+  std::string question;
+  std::shared_ptr<yai::session::Session> session;
+};
+
+// The task header of an answer.
+struct TaskHeader {
+  std::string taskname;
+  Pairs args;
+};
+
+inline static std::string_view Trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() &&
+         (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
 
-static pyAi::ABISettings abi_settings;
+// Push parser for the task protocol of the system prompt:
+//
+//   ---FIN---
+//   TASKNAME
+//   name: value
+//   ---AWK---
+//   answer
+//
+// Chunks are fed as they stream in. Header lines are taken as soon as they
+// end, and answer text is handed on at once, so only the header is ever
+// buffered. An answer without a header is passed through unchanged.
+class TaskParser {
+public:
+  template <class F> void Feed(std::string_view chunk, F &&on_answer) {
+    while (!chunk.empty()) {
+      switch (state_) {
+      case State::PROBE: {
+        const std::size_t n = std::min(chunk.size(), FIN.size() - line_.size());
+        line_.append(chunk.substr(0, n));
+        chunk.remove_prefix(n);
+
+        if (!FIN.starts_with(line_)) {
+          state_ = State::ANSWER;
+          on_answer(std::string_view{line_});
+          line_.clear();
+        } else if (line_.size() == FIN.size()) {
+          state_ = State::TASKNAME;
+          has_task_ = true;
+          line_.clear();
+        }
+        break;
+      }
 
-static PyObject *ProcessMessage(PyObject *, PyObject *args) {
-  if (!PyTuple_Check(args)) {
-    PyErr_SetString(PyExc_TypeError, "Expected a Tuple");
-    return nullptr;
-  }
+      case State::TASKNAME:
+      case State::ARGS: {
+        const std::size_t eol = chunk.find('\n');
+        line_.append(chunk.substr(0, eol));
+        if (eol == std::string_view::npos)
+          return;
 
-  if (PyTuple_Size(args) != 3) {
-    PyErr_SetString(PyExc_TypeError, "Expected a Tuple of size 3");
-    return nullptr;
-  }
-
-  PyObject *hist = PyTuple_GetItem(args, 0);
+        chunk.remove_prefix(eol + 1);
+        Line();
+        break;
+      }
 
-  if (!PyList_Check(hist)) {
-    PyErr_SetString(PyExc_TypeError, "Expected first List[Tuple[str, str]]");
-    return nullptr;
+      case State::ANSWER:
+        on_answer(chunk);
+        return;
+      }
+    }
   }
 
-  PyObject *new_q = PyTuple_GetItem(args, 1);
+  template <class F> void End(F &&on_answer) {
+    if (state_ == State::PROBE && !line_.empty())
+      on_answer(std::string_view{line_});
+    else if (state_ == State::TASKNAME || state_ == State::ARGS)
+      Line();
 
-  if (!PyUnicode_Check(new_q)) {
-    PyErr_SetString(PyExc_TypeError, "Expected second str");
-    return nullptr;
+    state_ = State::ANSWER;
   }
 
-  PyObject *scope = PyTuple_GetItem(args, 2);
+  bool has_task() const { return has_task_; }
 
-  if (!PyDict_Check(scope) and Py_None != scope) {
-    PyErr_SetString(PyExc_TypeError, "Expected third Dict[str, str]");
-    return nullptr;
-  }
+  const TaskHeader &task() const { return task_; }
 
-  std::unique_ptr<xai::Client> client =
-      xai::Client::Make(abi_settings.xai_api_key);
+private:
+  static constexpr std::string_view FIN = "---FIN---", AWK = "---AWK---";
 
-  if (!client) {
-    PyErr_SetString(PyExc_RuntimeError, "Error creating client");
-    return nullptr;
-  }
+  enum class State : std::uint8_t { PROBE, TASKNAME, ARGS, ANSWER };
 
-  std::unique_ptr<xai::Messages> messages =
-      xai::Messages::Make(abi_settings.xai_model);
+  // Takes the header line in line_; blank lines are skipped.
+  void Line() {
+    const std::string_view line = Trim(line_);
 
-  std::ifstream sinput("sinput");
+    if (state_ == State::TASKNAME && !line.empty()) {
+      task_.taskname = line;
+      state_ = State::ARGS;
+    } else if (line == AWK) {
+      state_ = State::ANSWER;
+    } else if (!line.empty()) {
+      const std::size_t colon = line.find(':');
+      auto &[name, value] = task_.args.emplace_back();
+      name = Trim(line.substr(0, colon));
+      if (colon != std::string_view::npos)
+        value = Trim(line.substr(colon + 1));
+    }
 
-  if (!sinput.is_open()) {
-    PyErr_SetString(PyExc_RuntimeError, "Error opening sinput");
-    return nullptr;
+    line_.clear();
   }
 
-  std::string sinput_str((std::istreambuf_iterator<char>(sinput)),
-                         std::istreambuf_iterator<char>());
+  State state_ = State::PROBE;
+  bool has_task_ = false;
+  std::string line_;
+  TaskHeader task_;
+};
 
-  sinput.close();
+inline static bool CopyString(PyObject *object, std::string &out,
+                              const char *what) {
+  Py_ssize_t size;
+  const char *s = PyUnicode_AsUTF8AndSize(object, &size);
 
-  std::ostringstream oss;
-  oss << sinput_str << '\n';
+  if (!s) {
+    PyErr_SetString(PyExc_TypeError, what);
+    return true;
+  }
+
+  out.assign(s, static_cast<std::size_t>(size));
+  return false;
+}
 
+inline static bool Unpack(const pyAi::ABISettings &settings, PyObject *hist,
+                          PyObject *new_q, PyObject *scope, Prompt &prompt) {
   if (scope != Py_None) {
     PyObject *key, *value;
     Py_ssize_t pos = 0;
     while (PyDict_Next(scope, &pos, &key, &value)) {
       if (!PyUnicode_Check(key)) {
         PyErr_SetString(PyExc_TypeError, "Expected a str key");
-        return nullptr;
+        return true;
       }
 
       if (!PyUnicode_Check(value)) {
         PyErr_SetString(PyExc_TypeError, "Expected a str value");
-        return nullptr;
+        return true;
       }
 
-      const char *k_s = PyUnicode_AsUTF8(key);
-      const char *v_s = PyUnicode_AsUTF8(value);
-
-      if (!k_s) {
-        PyErr_SetString(PyExc_TypeError, "Error getting key buffer");
-        return nullptr;
-      }
+      auto &[k, v] = prompt.scope.emplace_back();
 
-      if (!v_s) {
-        PyErr_SetString(PyExc_TypeError, "Error getting value buffer");
-        return nullptr;
-      }
-
-      oss << '\n' << k_s << ": " << v_s;
+      if (CopyString(key, k, "Error getting key buffer") ||
+          CopyString(value, v, "Error getting value buffer"))
+        return true;
     }
   }
 
-  messages->AddS(oss.str());
+  if (PyUnicode_Check(hist)) {
+    std::string id;
+    if (CopyString(hist, id, "Error getting session id"))
+      return true;
+
+    prompt.session =
+        yai::session::Store::Instance().Get(id, settings.session_idle);
+
+    return CopyString(new_q, prompt.question, "Error getting Q buffer");
+  }
 
   Py_ssize_t size = PyList_Size(hist);
+  prompt.history.reserve(static_cast<std::size_t>(size));
+
   for (Py_ssize_t i = 0; i < size; ++i) {
     PyObject *pair = PyList_GetItem(hist, i);
 
     if (!PyTuple_Check(pair)) {
       PyErr_SetString(PyExc_TypeError, "Expected a Tuple[str, str]");
-      return nullptr;
+      return true;
     }
 
     Py_ssize_t pair_size = PyTuple_Size(pair);
     if (pair_size != 2) {
       PyErr_SetString(PyExc_TypeError,
                       "Expected a Tuple[str, str] with two elements");
-      return nullptr;
+      return true;
     }
 
     PyObject *pair_q = PyTuple_GetItem(pair, 0);
@@ -117,391 +208,895 @@ static PyObject *ProcessMessage(PyObject *, PyObject *args) {
 
     if (!PyUnicode_Check(pair_q)) {
       PyErr_SetString(PyExc_TypeError, "Expected a Tuple[?, str] ");
-      return nullptr;
+      return true;
     }
 
     if (!PyUnicode_Check(pair_a)) {
       PyErr_SetString(PyExc_TypeError, "Expected a Tuple[str, ?] ");
-      return nullptr;
-    }
-
-    const char *q_s = PyUnicode_AsUTF8(pair_q);
-    const char *a_s = PyUnicode_AsUTF8(pair_a);
-
-    if (!q_s) {
-      PyErr_SetString(PyExc_TypeError, "Error getting Q buffer");
-      return nullptr;
+      return true;
     }
 
-    if (!a_s) {
-      PyErr_SetString(PyExc_TypeError, "Error getting A buffer");
-      return nullptr;
-    }
+    auto &[q, a] = prompt.history.emplace_back();
 
-    messages->AddU(q_s);
-    messages->AddA(a_s);
-  }
-
-  const char *q_s = PyUnicode_AsUTF8(new_q);
-  messages->AddU(q_s);
-
-  std::unique_ptr<xai::Choices> choices = client->ChatCompletion(messages);
-
-  if (!choices) {
-    PyErr_SetString(PyExc_RuntimeError, "Error getting choices");
-    return nullptr;
+    if (CopyString(pair_q, q, "Error getting Q buffer") ||
+        CopyString(pair_a, a, "Error getting A buffer"))
+      return true;
   }
 
-  std::string_view view = choices->first();
-
-  PyObject *res = PyDict_New();
+  return CopyString(new_q, prompt.question, "Error getting Q buffer");
+}
 
-  if (view.starts_with("---FIN---")) {
-    std::size_t taskname_end = view.find('\n', 10);
-    std::string_view taskname_sv = view.substr(10, taskname_end - 10);
+// Runs without the GIL.
+inline static bool MakeChat(const pyAi::ABISettings &settings,
+                            const Prompt &prompt, yai::ai::Chat &chat,
+                            pyAi::Error &error) {
+  const std::shared_ptr<const std::string> system_prompt =
+      settings.system_prompt->Get();
 
-    PyObject *taskname = PyUnicode_FromStringAndSize(
-        taskname_sv.data(), static_cast<Py_ssize_t>(taskname_sv.size()));
+  if (!system_prompt)
+    return error.Set(PyExc_RuntimeError, "System prompt not loaded");
 
-    if (!taskname) {
-      PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
-      return nullptr;
+  std::ostringstream oss;
+  oss << *system_prompt << '\n';
+
+  for (const auto &[k, v] : prompt.scope)
+    oss << '\n' << k << ": " << v;
+
+  chat.model = settings.xai_model;
+  chat.priority = yai::ai::Priority::INTERACTIVE;
+  chat.AddS(oss.str());
+
+  if (prompt.session) {
+    prompt.session->ForEach(settings.session_token_budget,
+                            [&](std::string_view q, std::string_view a) {
+                              chat.AddU(std::string{q});
+                              chat.AddA(std::string{a});
+                            });
+  } else {
+    for (const auto &[q, a] : prompt.history) {
+      chat.AddU(q);
+      chat.AddA(a);
     }
+  }
 
-    PyDict_SetItemString(res, "taskname", taskname);
-
-    std::size_t pos = taskname_end + 1;
-    std::size_t args_end = view.find("---AWK---", pos);
+  chat.AddU(prompt.question);
 
-    PyObject *pargs = PyDict_New();
+  return false;
+}
 
-    while (pos < args_end) {
-      std::size_t argname_end = view.find(':', pos);
-      std::string_view argname_sv = view.substr(pos, argname_end - pos);
-      pos = argname_end + 1;
+// Records a completed turn in the session, if the prompt has one.
+inline static void Remember(const pyAi::ABISettings &settings,
+                            const Prompt &prompt, std::string_view answer) {
+  if (prompt.session)
+    prompt.session->Append(prompt.question, answer,
+                           settings.session_token_budget);
+}
 
-      std::size_t arg_end = view.find('\n', pos);
-      std::string_view arg_sv = view.substr(pos, arg_end - pos);
+// How much of the pending streamed text to hand over now; 0 to keep
+// coalescing. Once the size or latency limit is reached, the text is cut
+// after its last line break, or else its last space, so that words and
+// markdown lines reach the callback whole.
+inline static std::size_t FlushSize(const pyAi::ABISettings &settings,
+                                    std::string_view pending,
+                                    std::chrono::steady_clock::duration age) {
+  if (pending.size() < settings.stream_flush_bytes &&
+      age < settings.stream_flush_latency)
+    return 0;
+
+  std::size_t cut = pending.rfind('\n');
+  if (cut == std::string_view::npos)
+    cut = pending.find_last_of(" \t");
+
+  return cut == std::string_view::npos ? pending.size() : cut + 1;
+}
 
-      while (arg_sv.size() > 0 && arg_sv[0] == ' ') {
-        arg_sv.remove_prefix(1);
-      }
+inline static PyObject *MakeString(std::string_view view) {
+  PyObject *s = PyUnicode_FromStringAndSize(
+      view.data(), static_cast<Py_ssize_t>(view.size()));
 
-      PyObject *arg = PyUnicode_FromStringAndSize(
-          arg_sv.data(), static_cast<Py_ssize_t>(arg_sv.size()));
+  if (!s)
+    PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
 
-      if (!arg) {
-        PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
-        return nullptr;
-      }
+  return s;
+}
 
-      const_cast<char *>(argname_sv.data())[argname_sv.size()] = '\0';
+// Fills res with taskname and args.
+inline static bool SetTask(PyObject *res, const TaskHeader &task) {
+  PyObject *taskname = MakeString(task.taskname);
+  if (!taskname)
+    return true;
 
-      PyDict_SetItemString(pargs, argname_sv.data(), arg);
+  const int failed = PyDict_SetItemString(res, "taskname", taskname);
+  Py_DECREF(taskname);
 
-      pos = arg_end + 1;
-    }
+  if (failed)
+    return true;
 
-    PyDict_SetItemString(res, "args", pargs);
+  PyObject *pargs = PyDict_New();
+  if (!pargs)
+    return true;
 
-    pos = args_end + 10;
-    view = view.substr(pos);
-  }
+  for (const auto &[argname_sv, arg_sv] : task.args) {
+    PyObject *arg = MakeString(arg_sv);
+    PyObject *argname = arg ? MakeString(argname_sv) : nullptr;
 
-  PyObject *new_a = PyUnicode_FromStringAndSize(
-      view.data(), static_cast<Py_ssize_t>(view.size()));
+    if (!argname || PyDict_SetItem(pargs, argname, arg)) {
+      Py_XDECREF(argname);
+      Py_XDECREF(arg);
+      Py_DECREF(pargs);
+      return true;
+    }
 
-  if (!new_a) {
-    PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
-    return nullptr;
+    Py_DECREF(argname);
+    Py_DECREF(arg);
   }
 
-  PyObject *new_pair = PyTuple_Pack(2, new_q, new_a);
-  PyList_Append(hist, new_pair);
+  const int args_failed = PyDict_SetItemString(res, "args", pargs);
+  Py_DECREF(pargs);
 
-  return res;
+  return args_failed != 0;
 }
 
-static PyObject *ProcessPartial(PyObject *, PyObject *args) {
+// The checked items of the argument tuple, borrowed.
+struct Args {
+  PyObject *hist, *new_q, *scope, *call, *cancel = nullptr;
+};
+
+// With cancel, the tuple may carry one more item, left unchecked in
+// out.cancel.
+inline static bool CheckArgs(PyObject *args, Py_ssize_t nargs, Args &out,
+                             bool cancel = false) {
   if (!PyTuple_Check(args)) {
     PyErr_SetString(PyExc_TypeError, "Expected a Tuple");
-    return nullptr;
+    return true;
   }
 
-  if (PyTuple_Size(args) != 4) {
+  const Py_ssize_t size = PyTuple_Size(args);
+
+  if (size != nargs && !(cancel && size == nargs + 1)) {
     PyErr_SetString(PyExc_TypeError, "Expected a Tuple of size 3");
-    return nullptr;
+    return true;
   }
 
-  PyObject *hist = PyTuple_GetItem(args, 0);
+  out.hist = PyTuple_GetItem(args, 0);
 
-  if (!PyList_Check(hist)) {
-    PyErr_SetString(PyExc_TypeError, "Expected first List[Tuple[str, str]]");
-    return nullptr;
+  if (!PyList_Check(out.hist) && !PyUnicode_Check(out.hist)) {
+    PyErr_SetString(PyExc_TypeError,
+                    "Expected first List[Tuple[str, str]] or str");
+    return true;
   }
 
-  PyObject *new_q = PyTuple_GetItem(args, 1);
+  out.new_q = PyTuple_GetItem(args, 1);
 
-  if (!PyUnicode_Check(new_q)) {
+  if (!PyUnicode_Check(out.new_q)) {
     PyErr_SetString(PyExc_TypeError, "Expected second str");
-    return nullptr;
+    return true;
   }
 
-  PyObject *scope = PyTuple_GetItem(args, 2);
+  out.scope = PyTuple_GetItem(args, 2);
 
-  if (!PyDict_Check(scope) and Py_None != scope) {
+  if (!PyDict_Check(out.scope) and Py_None != out.scope) {
     PyErr_SetString(PyExc_TypeError, "Expected third Dict[str, str]");
-    return nullptr;
+    return true;
   }
 
-  PyObject *call = PyTuple_GetItem(args, 3);
+  if (nargs < 4)
+    return false;
+
+  out.call = PyTuple_GetItem(args, 3);
 
-  if (!PyCallable_Check(call)) {
+  if (!PyCallable_Check(out.call)) {
     PyErr_SetString(PyExc_TypeError, "Expected forth call");
-    return nullptr;
+    return true;
   }
 
-  std::unique_ptr<xai::Client> client =
-      xai::Client::Make(abi_settings.xai_api_key);
+  if (size > nargs)
+    out.cancel = PyTuple_GetItem(args, nargs);
+
+  return false;
+}
 
-  if (!client) {
-    PyErr_SetString(PyExc_RuntimeError, "Error creating client");
+} // namespace Chat_Utils
+
+namespace CancelToken_Utils {
+
+// CancelToken(): passed to ProcessPartial to abort its upstream request
+// from another thread, e.g. once the client is gone.
+struct Object {
+  PyObject_HEAD
+  std::shared_ptr<yai::ai::CancelToken> token;
+};
+
+static PyObject *New(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+  if (PyTuple_Size(args) || (kwargs && PyDict_Size(kwargs))) {
+    PyErr_SetString(PyExc_TypeError, "CancelToken takes no arguments");
     return nullptr;
   }
 
-  std::unique_ptr<xai::Messages> messages =
-      xai::Messages::Make(abi_settings.xai_model);
+  Object *self = reinterpret_cast<Object *>(type->tp_alloc(type, 0));
+  if (!self)
+    return nullptr;
 
-  std::ifstream sinput("sinput");
+  new (&self->token) std::shared_ptr<yai::ai::CancelToken>{
+      std::make_shared<yai::ai::CancelToken>()};
 
-  if (!sinput.is_open()) {
-    PyErr_SetString(PyExc_RuntimeError, "Error opening sinput");
+  return reinterpret_cast<PyObject *>(self);
+}
+
+static void Dealloc(PyObject *op) {
+  Object *self = reinterpret_cast<Object *>(op);
+  PyTypeObject *type = Py_TYPE(op);
+
+  self->token.~shared_ptr();
+
+  type->tp_free(op);
+  Py_DECREF(type);
+}
+
+static PyObject *Cancel(PyObject *op, PyObject *) {
+  reinterpret_cast<Object *>(op)->token->Cancel();
+  Py_RETURN_NONE;
+}
+
+static PyObject *GetCancelled(PyObject *op, void *) {
+  return PyBool_FromLong(reinterpret_cast<Object *>(op)->token->cancelled());
+}
+
+// The token of a CancelToken object, or null with TypeError set.
+inline static std::shared_ptr<yai::ai::CancelToken> Get(PyObject *obj) {
+  if (PyType_GetSlot(Py_TYPE(obj), Py_tp_dealloc) !=
+      reinterpret_cast<void *>(Dealloc)) {
+    PyErr_SetString(PyExc_TypeError, "Expected fifth CancelToken");
     return nullptr;
   }
 
-  std::string sinput_str((std::istreambuf_iterator<char>(sinput)),
-                         std::istreambuf_iterator<char>());
+  return reinterpret_cast<Object *>(obj)->token;
+}
 
-  sinput.close();
+static PyMethodDef methods[] = {{"cancel", Cancel, METH_NOARGS, nullptr},
+                                {nullptr, nullptr, 0, nullptr}};
 
-  std::ostringstream oss;
-  oss << sinput_str << '\n';
+static PyGetSetDef getset[] = {
+    {"cancelled", GetCancelled, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
 
-  if (scope != Py_None) {
-    PyObject *key, *value;
-    Py_ssize_t pos = 0;
-    while (PyDict_Next(scope, &pos, &key, &value)) {
-      if (!PyUnicode_Check(key)) {
-        PyErr_SetString(PyExc_TypeError, "Expected a str key");
-        return nullptr;
-      }
+static PyType_Slot slots[] = {
+    {Py_tp_new, reinterpret_cast<void *>(New)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(Dealloc)},
+    {Py_tp_methods, methods},
+    {Py_tp_getset, getset},
+    {0, nullptr}};
 
-      if (!PyUnicode_Check(value)) {
-        PyErr_SetString(PyExc_TypeError, "Expected a str value");
-        return nullptr;
-      }
+static PyType_Spec spec = {"yai_chat_abi.CancelToken", sizeof(Object), 0,
+                           Py_TPFLAGS_DEFAULT, slots};
 
-      const char *k_s = PyUnicode_AsUTF8(key);
-      const char *v_s = PyUnicode_AsUTF8(value);
+static int Exec(PyObject *module) {
+  PyObject *type = PyType_FromModuleAndSpec(module, &spec, nullptr);
+  if (!type)
+    return -1;
 
-      if (!k_s) {
-        PyErr_SetString(PyExc_TypeError, "Error getting key buffer");
-        return nullptr;
-      }
+  const int failed = PyModule_AddObjectRef(module, "CancelToken", type);
+  Py_DECREF(type);
 
-      if (!v_s) {
-        PyErr_SetString(PyExc_TypeError, "Error getting value buffer");
-        return nullptr;
-      }
+  return failed;
+}
 
-      oss << '\n' << k_s << ": " << v_s;
-    }
+} // namespace CancelToken_Utils
+
+namespace ProcessMessage_Utils {
+
+struct Task {
+  std::shared_ptr<const pyAi::ABISettings> settings;
+  PyObject *hist = nullptr, *new_q = nullptr;
+  Chat_Utils::Prompt prompt;
+  Chat_Utils::TaskParser parser;
+  std::string answer;
+  pyAi::Error error;
+
+  Task() = default;
+  ~Task() {
+    Py_XDECREF(hist);
+    Py_XDECREF(new_q);
   }
 
-  messages->AddS(oss.str());
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
 
-  Py_ssize_t size = PyList_Size(hist);
-  for (Py_ssize_t i = 0; i < size; ++i) {
-    PyObject *pair = PyList_GetItem(hist, i);
+  bool Prepare(PyObject *args) {
+    Chat_Utils::Args checked;
+    if (Chat_Utils::CheckArgs(args, 3, checked) ||
+        Chat_Utils::Unpack(*settings, checked.hist, checked.new_q,
+                           checked.scope, prompt))
+      return true;
 
-    if (!PyTuple_Check(pair)) {
-      PyErr_SetString(PyExc_TypeError, "Expected a Tuple[str, str]");
-      return nullptr;
-    }
+    hist = Py_NewRef(checked.hist);
+    new_q = Py_NewRef(checked.new_q);
 
-    Py_ssize_t pair_size = PyTuple_Size(pair);
-    if (pair_size != 2) {
-      PyErr_SetString(PyExc_TypeError,
-                      "Expected a Tuple[str, str] with two elements");
-      return nullptr;
+    return false;
+  }
+
+  void Run(pyAi::ThreadState &) {
+    yai::ai::Chat chat;
+    if (Chat_Utils::MakeChat(*settings, prompt, chat, error))
+      return;
+
+    std::string ai_error, completion;
+    if (settings->xai->Complete(chat, completion, ai_error)) {
+      error.Set(PyExc_RuntimeError, ai_error);
+      return;
     }
 
-    PyObject *pair_q = PyTuple_GetItem(pair, 0);
-    PyObject *pair_a = PyTuple_GetItem(pair, 1);
+    const auto append = [&](std::string_view text) { answer.append(text); };
+    parser.Feed(completion, append);
+    parser.End(append);
 
-    if (!PyUnicode_Check(pair_q)) {
-      PyErr_SetString(PyExc_TypeError, "Expected a Tuple[?, str] ");
+    Chat_Utils::Remember(*settings, prompt, answer);
+  }
+
+  PyObject *Finish() {
+    if (error)
+      return error.Raise();
+
+    PyObject *res = PyDict_New();
+    if (!res)
       return nullptr;
-    }
 
-    if (!PyUnicode_Check(pair_a)) {
-      PyErr_SetString(PyExc_TypeError, "Expected a Tuple[str, ?] ");
+    if (parser.has_task() && Chat_Utils::SetTask(res, parser.task())) {
+      Py_DECREF(res);
       return nullptr;
     }
 
-    const char *q_s = PyUnicode_AsUTF8(pair_q);
-    const char *a_s = PyUnicode_AsUTF8(pair_a);
+    if (!PyList_Check(hist))
+      return res;
 
-    if (!q_s) {
-      PyErr_SetString(PyExc_TypeError, "Error getting Q buffer");
+    PyObject *new_a = Chat_Utils::MakeString(answer);
+    if (!new_a) {
+      Py_DECREF(res);
       return nullptr;
     }
 
-    if (!a_s) {
-      PyErr_SetString(PyExc_TypeError, "Error getting A buffer");
+    PyObject *new_pair = PyTuple_Pack(2, new_q, new_a);
+    Py_DECREF(new_a);
+
+    if (!new_pair || PyList_Append(hist, new_pair)) {
+      Py_XDECREF(new_pair);
+      Py_DECREF(res);
       return nullptr;
     }
 
-    messages->AddU(q_s);
-    messages->AddA(a_s);
+    Py_DECREF(new_pair);
+
+    return res;
   }
+};
 
-  const char *q_s = PyUnicode_AsUTF8(new_q);
-  messages->AddU(q_s);
+} // namespace ProcessMessage_Utils
 
-  bool reserve = false;
-  std::string acc;
-  acc.reserve(128);
+namespace ProcessPartial_Utils {
 
-  client->ChatCompletion(messages, [&](std::unique_ptr<xai::Choices> choices) {
-    if (!choices) {
-      PyErr_SetString(PyExc_RuntimeError, "Error getting choices");
-      return;
-    }
+struct Task {
+  std::shared_ptr<const pyAi::ABISettings> settings;
+  PyObject *call = nullptr, *loop = nullptr;
+  Chat_Utils::Prompt prompt;
+  std::shared_ptr<yai::ai::CancelToken> cancel;
+
+  Chat_Utils::TaskParser parser;
+  std::string acc, answer;
+  std::chrono::steady_clock::time_point acc_since;
+  pyAi::Error error;
 
-    std::string_view rview = choices->first();
+  // Set when delivering a chunk raised; the exception stays pending and no
+  // more chunks are delivered.
+  bool call_failed = false;
+
+  Task() = default;
+  ~Task() {
+    Py_XDECREF(call);
+    Py_XDECREF(loop);
+  }
 
-    acc.append(rview.data(), rview.size());
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
 
-    if (acc.size() < 10) {
+  bool Prepare(PyObject *args) {
+    Chat_Utils::Args checked;
+    if (Chat_Utils::CheckArgs(args, 4, checked, true) ||
+        Chat_Utils::Unpack(*settings, checked.hist, checked.new_q,
+                           checked.scope, prompt))
+      return true;
+
+    if (checked.cancel && checked.cancel != Py_None &&
+        !(cancel = CancelToken_Utils::Get(checked.cancel)))
+      return true;
+
+    call = Py_NewRef(checked.call);
+    acc.reserve(settings->stream_flush_bytes + 128);
+
+    return false;
+  }
+
+  // Awaited: chunks are handed to call on the event loop thread.
+  void OnLoop(PyObject *running_loop) { loop = Py_NewRef(running_loop); }
+
+  void Emit(std::string_view view) {
+    PyObject *new_a = Chat_Utils::MakeString(view);
+
+    if (!new_a) {
+      call_failed = true;
       return;
     }
 
-    if (acc.starts_with("---FIN---")) {
-      reserve = true;
-    }
+    PyObject *ret =
+        loop ? PyObject_CallMethod(loop, "call_soon_threadsafe", "OO", call,
+                                   new_a)
+             : PyObject_CallFunctionObjArgs(call, new_a, nullptr);
+    Py_DECREF(new_a);
 
-    if (reserve) {
+    if (!ret) {
+      call_failed = true;
       return;
     }
 
-    std::string_view view = acc;
+    Py_DECREF(ret);
+  }
 
-    PyObject *new_a = PyUnicode_FromStringAndSize(
-        view.data(), static_cast<Py_ssize_t>(view.size()));
+  void Run(pyAi::ThreadState &thread) {
+    yai::ai::Chat chat;
+    if (Chat_Utils::MakeChat(*settings, prompt, chat, error))
+      return;
 
-    if (!new_a) {
-      PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
+    const auto append = [&](std::string_view text) {
+      if (acc.empty())
+        acc_since = std::chrono::steady_clock::now();
+      acc.append(text);
+      answer.append(text);
+    };
+
+    std::string ai_error;
+    if (settings->xai->Stream(
+            chat,
+            [&](std::string_view delta) {
+              parser.Feed(delta, append);
+
+              const auto now = std::chrono::steady_clock::now();
+              const std::size_t size =
+                  Chat_Utils::FlushSize(*settings, acc, now - acc_since);
+
+              if (!size)
+                return true;
+
+              thread.WithGIL(
+                  [&] { Emit(std::string_view{acc}.substr(0, size)); });
+
+              acc.erase(0, size);
+              acc_since = now;
+
+              return !call_failed;
+            },
+            ai_error, cancel.get())) {
+      if (!cancelled())
+        error.Set(PyExc_RuntimeError, ai_error);
       return;
     }
 
-    PyObject_CallFunctionObjArgs(call, new_a, nullptr);
+    parser.End(append);
 
-    acc.clear();
-  });
+    if (!call_failed)
+      Chat_Utils::Remember(*settings, prompt, answer);
+  }
 
-  PyObject *ref = Py_None;
+  bool cancelled() const { return cancel && cancel->cancelled(); }
 
-  if (!acc.empty()) {
-    PyObject *res = PyDict_New();
+  // A cancelled call delivers nothing more and returns None.
+  PyObject *Finish() {
+    if (call_failed)
+      return nullptr;
 
-    std::string_view view = acc;
+    if (error)
+      return error.Raise();
 
-    if (view.starts_with("---FIN---")) {
-      std::size_t taskname_end = view.find('\n', 10);
-      std::string_view taskname_sv = view.substr(10, taskname_end - 10);
+    if (cancelled())
+      Py_RETURN_NONE;
 
-      PyObject *taskname = PyUnicode_FromStringAndSize(
-          taskname_sv.data(), static_cast<Py_ssize_t>(taskname_sv.size()));
+    if (!acc.empty()) {
+      Emit(acc);
 
-      if (!taskname) {
-        PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
+      if (call_failed)
         return nullptr;
-      }
+    }
 
-      PyDict_SetItemString(res, "taskname", taskname);
+    if (!parser.has_task())
+      Py_RETURN_NONE;
 
-      std::size_t pos = taskname_end + 1;
-      std::size_t args_end = view.find("---AWK---", pos);
+    PyObject *res = PyDict_New();
 
-      PyObject *pargs = PyDict_New();
+    if (!res || Chat_Utils::SetTask(res, parser.task())) {
+      Py_XDECREF(res);
+      return nullptr;
+    }
 
-      while (pos < args_end) {
-        std::size_t argname_end = view.find(':', pos);
-        std::string_view argname_sv = view.substr(pos, argname_end - pos);
-        pos = argname_end + 1;
+    return res;
+  }
+};
 
-        std::size_t arg_end = view.find('\n', pos);
-        std::string_view arg_sv = view.substr(pos, arg_end - pos);
+} // namespace ProcessPartial_Utils
 
-        while (arg_sv.size() > 0 && arg_sv[0] == ' ') {
-          arg_sv.remove_prefix(1);
-        }
+namespace ProcessStream_Utils {
 
-        PyObject *arg = PyUnicode_FromStringAndSize(
-            arg_sv.data(), static_cast<Py_ssize_t>(arg_sv.size()));
+// Shared by the iterator and the native thread producing its frames. The
+// result fields are written by the producer before frames.Finish().
+struct Channel {
+  yai::SpscQueue<std::string, 64> frames;
 
-        if (!arg) {
-          PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
-          return nullptr;
-        }
+  Chat_Utils::TaskParser parser;
+  std::string answer;
+  pyAi::Error error;
 
-        const_cast<char *>(argname_sv.data())[argname_sv.size()] = '\0';
+  // Aborts the upstream request once the consumer is gone.
+  yai::ai::CancelToken cancel;
 
-        PyDict_SetItemString(pargs, argname_sv.data(), arg);
+  // Consumer side.
+  std::atomic<bool> iterating{false};
+  bool done = false;
+};
 
-        pos = arg_end + 1;
-      }
+struct Object {
+  PyObject_HEAD
+  PyObject *hist, *new_q, *task;
+  std::shared_ptr<Channel> channel;
+};
 
-      PyDict_SetItemString(res, "args", pargs);
+// text as one server-sent event, one data line per line of text.
+inline static void Frame(std::string_view text, std::string &frame) {
+  frame.clear();
+  frame.reserve(text.size() + 16);
 
-      pos = args_end + 10;
-      view = view.substr(pos);
+  for (;;) {
+    const std::size_t eol = text.find('\n');
+    frame.append("data: ").append(text.substr(0, eol)).push_back('\n');
 
-      ref = res;
+    if (eol == std::string_view::npos)
+      break;
+
+    text.remove_prefix(eol + 1);
+  }
+
+  frame.push_back('\n');
+}
+
+// Runs on a thread of its own and never touches Python. Stops streaming as
+// soon as the iterator goes away.
+static void Produce(const pyAi::ABISettings &settings,
+                    const Chat_Utils::Prompt &prompt, Channel &channel) {
+  std::string acc, frame;
+  auto acc_since = std::chrono::steady_clock::now();
+
+  const auto append = [&](std::string_view text) {
+    if (acc.empty())
+      acc_since = std::chrono::steady_clock::now();
+    acc.append(text);
+    channel.answer.append(text);
+  };
+
+  const auto send = [&](std::size_t size) {
+    Frame(std::string_view{acc}.substr(0, size), frame);
+    acc.erase(0, size);
+
+    while (!channel.frames.Push(frame)) {
+      if (channel.frames.closed())
+        return false;
+      channel.frames.WaitPush();
     }
 
-    PyObject *new_a = PyUnicode_FromStringAndSize(
-        view.data(), static_cast<Py_ssize_t>(view.size()));
+    return !channel.frames.closed();
+  };
 
-    if (!new_a) {
-      PyErr_SetString(PyExc_RuntimeError, "Error creating bytes");
+  const auto on_delta = [&](std::string_view delta) {
+    channel.parser.Feed(delta, append);
+
+    const auto now = std::chrono::steady_clock::now();
+    const std::size_t size =
+        Chat_Utils::FlushSize(settings, acc, now - acc_since);
+
+    if (!size)
+      return true;
+
+    acc_since = now;
+    return send(size);
+  };
+
+  yai::ai::Chat chat;
+  std::string ai_error;
+
+  if (!Chat_Utils::MakeChat(settings, prompt, chat, channel.error)) {
+    if (settings.xai->Stream(chat, on_delta, ai_error, &channel.cancel)) {
+      if (!channel.frames.closed())
+        channel.error.Set(PyExc_RuntimeError, ai_error);
+    } else if (!channel.frames.closed()) {
+      channel.parser.End(append);
+
+      if (!acc.empty())
+        send(acc.size());
+
+      Chat_Utils::Remember(settings, prompt, channel.answer);
+    }
+  }
+
+  channel.frames.Finish();
+}
+
+// ProcessStream(hist, q, scope): starts the request and returns the
+// iterator over its frames.
+static PyObject *New(PyTypeObject *type, PyObject *args, PyObject *) {
+  std::shared_ptr<const pyAi::ABISettings> settings =
+      pyAi::Settings(PyType_GetModule(type));
+  if (!settings)
+    return nullptr;
+
+  Chat_Utils::Args checked;
+  Chat_Utils::Prompt prompt;
+
+  if (Chat_Utils::CheckArgs(args, 3, checked) ||
+      Chat_Utils::Unpack(*settings, checked.hist, checked.new_q, checked.scope,
+                         prompt))
+    return nullptr;
+
+  Object *self = reinterpret_cast<Object *>(type->tp_alloc(type, 0));
+  if (!self)
+    return nullptr;
+
+  new (&self->channel) std::shared_ptr<Channel>{std::make_shared<Channel>()};
+  self->hist = Py_NewRef(checked.hist);
+  self->new_q = Py_NewRef(checked.new_q);
+  self->task = Py_NewRef(Py_None);
+
+  // Not on the Executor: a producer waits on its consumer for as long as
+  // the stream is open, and would hold back the awaitable calls queued
+  // there.
+  try {
+    std::thread{[settings = std::move(settings), prompt = std::move(prompt),
+                 channel = self->channel] {
+      Produce(*settings, prompt, *channel);
+    }}.detach();
+  } catch (const std::system_error &e) {
+    Py_DECREF(self);
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return nullptr;
+  }
+
+  return reinterpret_cast<PyObject *>(self);
+}
+
+static void Dealloc(PyObject *op) {
+  Object *self = reinterpret_cast<Object *>(op);
+  PyTypeObject *type = Py_TYPE(op);
+
+  self->channel->frames.Close();
+  self->channel->cancel.Cancel();
+  self->channel.~shared_ptr();
+
+  Py_XDECREF(self->hist);
+  Py_XDECREF(self->new_q);
+  Py_XDECREF(self->task);
+
+  type->tp_free(op);
+  Py_DECREF(type);
+}
+
+// Appends (q, answer) to a hist list and keeps the task once the stream is
+// over.
+// Always null: with the error set, or with none to stop the iteration.
+static PyObject *End(Object *self, Channel &channel) {
+  channel.done = true;
+
+  if (channel.error)
+    return channel.error.Raise();
+
+  if (PyList_Check(self->hist)) {
+    PyObject *new_a = Chat_Utils::MakeString(channel.answer);
+    if (!new_a)
+      return nullptr;
+
+    PyObject *new_pair = PyTuple_Pack(2, self->new_q, new_a);
+    Py_DECREF(new_a);
+
+    if (!new_pair || PyList_Append(self->hist, new_pair)) {
+      Py_XDECREF(new_pair);
+      return nullptr;
+    }
+
+    Py_DECREF(new_pair);
+  }
+
+  if (channel.parser.has_task()) {
+    PyObject *task = PyDict_New();
+
+    if (!task || Chat_Utils::SetTask(task, channel.parser.task())) {
+      Py_XDECREF(task);
       return nullptr;
     }
 
-    PyObject_CallFunctionObjArgs(call, new_a, nullptr);
+    Py_SETREF(self->task, task);
+  }
+
+  return nullptr;
+}
+
+static PyObject *Next(PyObject *op) {
+  Object *self = reinterpret_cast<Object *>(op);
+  Channel &channel = *self->channel;
+
+  if (channel.iterating.exchange(true)) {
+    PyErr_SetString(PyExc_RuntimeError, "ProcessStream is already iterating");
+    return nullptr;
+  }
+
+  PyObject *res = nullptr;
+  std::string frame;
+
+  while (!channel.done) {
+    const bool finished = channel.frames.finished();
+
+    if (channel.frames.Pop(frame)) {
+      res = PyBytes_FromStringAndSize(frame.data(),
+                                      static_cast<Py_ssize_t>(frame.size()));
+      break;
+    }
+
+    if (finished) {
+      res = End(self, channel);
+      break;
+    }
+
+    pyAi::AllowThreads allow_threads;
+    channel.frames.WaitPop();
+  }
+
+  channel.iterating = false;
+
+  return res;
+}
+
+// close(): stops the iteration and aborts the upstream request, which
+// gives its connection up instead of draining the rest of the answer.
+static PyObject *Close(PyObject *op, PyObject *) {
+  Channel &channel = *reinterpret_cast<Object *>(op)->channel;
+
+  channel.done = true;
+  channel.frames.Close();
+  channel.cancel.Cancel();
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *GetTask(PyObject *op, void *) {
+  return Py_NewRef(reinterpret_cast<Object *>(op)->task);
+}
+
+static PyMethodDef methods[] = {{"close", Close, METH_NOARGS, nullptr},
+                                {nullptr, nullptr, 0, nullptr}};
+
+static PyGetSetDef getset[] = {
+    {"task", GetTask, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+static PyType_Slot slots[] = {
+    {Py_tp_new, reinterpret_cast<void *>(New)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(Dealloc)},
+    {Py_tp_iter, reinterpret_cast<void *>(PyObject_SelfIter)},
+    {Py_tp_iternext, reinterpret_cast<void *>(Next)},
+    {Py_tp_methods, methods},
+    {Py_tp_getset, getset},
+    {0, nullptr}};
+
+static PyType_Spec spec = {"yai_chat_abi.ProcessStream", sizeof(Object), 0,
+                           Py_TPFLAGS_DEFAULT, slots};
+
+static int Exec(PyObject *module) {
+  PyObject *type = PyType_FromModuleAndSpec(module, &spec, nullptr);
+  if (!type)
+    return -1;
+
+  const int failed = PyModule_AddObjectRef(module, "ProcessStream", type);
+  Py_DECREF(type);
+
+  return failed;
+}
+
+} // namespace ProcessStream_Utils
+
+namespace Session_Utils {
+
+// SessionHistory(id): the turns of the session as List[Tuple[str, str]].
+static PyObject *History(PyObject *module, PyObject *arg) {
+  std::shared_ptr<const pyAi::ABISettings> settings = pyAi::Settings(module);
+  if (!settings)
+    return nullptr;
+
+  std::string id;
+  if (Chat_Utils::CopyString(arg, id, "Expected a str session id"))
+    return nullptr;
+
+  std::shared_ptr<yai::session::Session> session =
+      yai::session::Store::Instance().Get(id, settings->session_idle);
+
+  PyObject *hist = PyList_New(0);
+  if (!hist)
+    return nullptr;
+
+  bool failed = false;
+
+  session->ForEach(SIZE_MAX, [&](std::string_view q, std::string_view a) {
+    if (failed)
+      return;
+
+    PyObject *pair = Py_BuildValue("(s#s#)", q.data(),
+                                   static_cast<Py_ssize_t>(q.size()),
+                                   a.data(), static_cast<Py_ssize_t>(a.size()));
+
+    failed = !pair || PyList_Append(hist, pair);
+    Py_XDECREF(pair);
+  });
+
+  if (failed) {
+    Py_DECREF(hist);
+    return nullptr;
   }
 
-  return ref;
+  return hist;
 }
 
+// SessionClear(id)
+static PyObject *Clear(PyObject *, PyObject *arg) {
+  std::string id;
+  if (Chat_Utils::CopyString(arg, id, "Expected a str session id"))
+    return nullptr;
+
+  yai::session::Store::Instance().Erase(id);
+
+  Py_RETURN_NONE;
+}
+
+} // namespace Session_Utils
+
 static PyMethodDef m_methods[] = {
-    {"ProcessMessage", ProcessMessage, METH_VARARGS, nullptr},
-    {"ProcessPartial", ProcessPartial, METH_VARARGS, nullptr},
+    {"ProcessMessage", pyAi::Sync<ProcessMessage_Utils::Task>, METH_VARARGS,
+     nullptr},
+    {"ProcessMessageAsync", pyAi::Async<ProcessMessage_Utils::Task>,
+     METH_VARARGS, nullptr},
+    {"ProcessPartial", pyAi::Sync<ProcessPartial_Utils::Task>, METH_VARARGS,
+     nullptr},
+    {"ProcessPartialAsync", pyAi::Async<ProcessPartial_Utils::Task>,
+     METH_VARARGS, nullptr},
+    {"SessionHistory", Session_Utils::History, METH_O, nullptr},
+    {"SessionClear", Session_Utils::Clear, METH_O, nullptr},
+    {"CacheStats", pyAi::CacheStats, METH_NOARGS, nullptr},
+    {"SchedulerStats", pyAi::SchedulerStats, METH_NOARGS, nullptr},
     {nullptr, nullptr, 0, nullptr}};
 
+static PyModuleDef_Slot m_slots[] = {
+    {Py_mod_exec, reinterpret_cast<void *>(pyAi::ExecModule)},
+    {Py_mod_exec, reinterpret_cast<void *>(ProcessStream_Utils::Exec)},
+    {Py_mod_exec, reinterpret_cast<void *>(CancelToken_Utils::Exec)},
+#if PY_VERSION_HEX >= 0x030C0000
+    // The caches, scheduler and executor are process-wide.
+    {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_NOT_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, nullptr}};
+
 static struct PyModuleDef pymoduledef = {PyModuleDef_HEAD_INIT,
                                          "yai_chat_abi",
                                          "yAI Chat ABI Module",
-                                         -1,
+                                         sizeof(pyAi::ModuleState),
                                          m_methods,
+                                         m_slots,
                                          nullptr,
                                          nullptr,
-                                         nullptr,
-                                         nullptr};
+                                         pyAi::FreeModule};
 
 PyMODINIT_FUNC PyInit_yai_chat_abi(void) {
-  if (pyAi::InitSettings(abi_settings))
-    return nullptr;
-  return PyModule_Create(&pymoduledef);
+  return PyModuleDef_Init(&pymoduledef);
 }
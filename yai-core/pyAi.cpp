@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
 
 #include "pyAi.hpp"
 
@@ -14,71 +18,421 @@ inline static void Warning(const char *message) {
 }
 
 } // namespace conio
+
+// (future, result, exception): settles future unless it was cancelled
+// meanwhile. Scheduled on the loop by pyAi::Resolve.
+static PyObject *SetFuture(PyObject *, PyObject *args) {
+  PyObject *future, *result, *exception;
+  if (!PyArg_ParseTuple(args, "OOO", &future, &result, &exception))
+    return nullptr;
+
+  PyObject *done = PyObject_CallMethod(future, "done", nullptr);
+  if (!done)
+    return nullptr;
+
+  const int is_done = PyObject_IsTrue(done);
+  Py_DECREF(done);
+
+  if (is_done < 0)
+    return nullptr;
+
+  if (is_done)
+    Py_RETURN_NONE;
+
+  if (exception != Py_None)
+    return PyObject_CallMethod(future, "set_exception", "O", exception);
+
+  return PyObject_CallMethod(future, "set_result", "O", result);
+}
+
+static PyMethodDef set_future_def = {"_set_future", SetFuture, METH_VARARGS,
+                                     nullptr};
+
 } // namespace
 
 namespace pyAi {
 
-bool InitSettings(ABISettings &abi_settings) {
+// Owned copy of a str setting; false when it is missing or not a str.
+static bool CopySetting(PyObject *settings, const char *name,
+                        std::string &out) {
+  PyObject *value = PyObject_GetAttrString(settings, name);
+
+  if (!value) {
+    PyErr_Clear();
+    return false;
+  }
+
+  Py_ssize_t size;
+  const char *s =
+      PyUnicode_Check(value) ? PyUnicode_AsUTF8AndSize(value, &size) : nullptr;
+
+  if (s)
+    out.assign(s, static_cast<std::size_t>(size));
+  else
+    PyErr_Clear();
+
+  Py_DECREF(value);
+
+  return s != nullptr;
+}
+
+// Value of a non-negative int setting; false when it is missing or not one.
+static bool CopySetting(PyObject *settings, const char *name,
+                        std::size_t &out) {
+  PyObject *value = PyObject_GetAttrString(settings, name);
+
+  if (!value) {
+    PyErr_Clear();
+    return false;
+  }
+
+  const std::size_t n = PyLong_Check(value) ? PyLong_AsSize_t(value)
+                                            : static_cast<std::size_t>(-1);
+  Py_DECREF(value);
+
+  if (n == static_cast<std::size_t>(-1)) {
+    PyErr_Clear();
+    return false;
+  }
+
+  out = n;
+
+  return true;
+}
+
+// The client, and so the response cache, of a configuration. The ABI modules
+// load their settings separately and must not keep two caches of one
+// directory.
+static std::shared_ptr<const yai::ai::Client>
+SharedClient(const std::string &base_url, const std::string &api_key,
+             std::size_t cache_bytes, std::size_t cache_ttl,
+             const std::string &cache_directory, std::size_t timeout) {
+  using Entry = std::pair<std::string, std::weak_ptr<const yai::ai::Client>>;
+
+  static std::mutex mutex;
+  static std::vector<Entry> clients;
+
+  std::string key = base_url;
+  key.append(1, '\0').append(api_key).append(1, '\0');
+  key.append(std::to_string(cache_bytes)).append(1, '\0');
+  key.append(std::to_string(cache_ttl)).append(1, '\0');
+  key.append(cache_directory).append(1, '\0');
+  key.append(std::to_string(timeout));
+
+  std::lock_guard lock{mutex};
+
+  for (auto &[config, weak] : clients)
+    if (config == key)
+      if (std::shared_ptr<const yai::ai::Client> client = weak.lock())
+        return client;
+
+  // YAI_CACHE_BYTES = 0 turns the response cache off.
+  std::unique_ptr<yai::cache::ResponseCache> cache;
+  if (cache_bytes && cache_ttl)
+    cache = std::make_unique<yai::cache::ResponseCache>(
+        cache_bytes, std::chrono::seconds{cache_ttl}, cache_directory);
+
+  std::shared_ptr<const yai::ai::Client> client =
+      yai::ai::Client::Make(base_url, api_key, std::move(cache),
+                            std::chrono::seconds{timeout});
+
+  if (!client)
+    return nullptr;
+
+  std::erase_if(clients,
+                [](const Entry &entry) { return entry.second.expired(); });
+  clients.emplace_back(std::move(key), client);
+
+  return client;
+}
+
+static std::shared_ptr<const ABISettings> LoadSettings() {
   PyObject *dj_conf = PyImport_ImportModule("django.conf");
 
   if (!dj_conf) {
     PyErr_SetString(PyExc_RuntimeError, "Error importing django.conf");
-    return true;
+    return nullptr;
   }
 
   PyObject *settings = PyObject_GetAttrString(dj_conf, "settings");
+  Py_DECREF(dj_conf);
 
   if (!settings) {
     PyErr_SetString(PyExc_RuntimeError, "Error getting settings");
-    return true;
+    return nullptr;
   }
 
-  PyObject *xai_api_key = PyObject_GetAttrString(settings, "XAI_API_KEY");
-  if (xai_api_key) {
-    if (xai_api_key == Py_None) {
-      conio::Danger("XAI_API_KEY is None");
-      Py_DECREF(xai_api_key);
-    } else {
-      abi_settings.xai_api_key = PyUnicode_AsUTF8(xai_api_key);
+  auto abi_settings = std::make_shared<ABISettings>();
+  std::string xai_api_key, xai_base_url, cache_directory;
+  std::size_t cache_bytes, cache_ttl, timeout;
 
-      if (!abi_settings.xai_api_key) {
-        conio::Danger("XAI_API_KEY is empty");
-      }
+  if (!CopySetting(settings, "XAI_API_KEY", xai_api_key))
+    conio::Danger("XAI_API_KEY not found in settings");
+  else if (xai_api_key.empty())
+    conio::Danger("XAI_API_KEY is empty");
 
-      if (strnlen(abi_settings.xai_api_key, 32) == 0) {
-        conio::Danger("XAI_API_KEY is too short");
-      }
+  if (!CopySetting(settings, "XAI_BASE_URL", xai_base_url))
+    xai_base_url = "https://api.x.ai/v1";
 
-      Py_DECREF(xai_api_key);
-    }
-  } else {
-    conio::Danger("XAI_API_KEY not found in settings");
+  if (!CopySetting(settings, "YAI_CACHE_BYTES", cache_bytes))
+    cache_bytes = 64 << 20;
+
+  if (!CopySetting(settings, "YAI_CACHE_TTL_SECONDS", cache_ttl))
+    cache_ttl = 3600;
+
+  CopySetting(settings, "YAI_CACHE_DIR", cache_directory);
+
+  if (!CopySetting(settings, "XAI_TIMEOUT_SECONDS", timeout) || !timeout)
+    timeout = 120;
+
+  abi_settings->xai = SharedClient(xai_base_url, xai_api_key, cache_bytes,
+                                   cache_ttl, cache_directory, timeout);
+
+  if (!abi_settings->xai) {
+    Py_DECREF(settings);
+    PyErr_SetString(PyExc_ValueError, "Invalid XAI_BASE_URL");
+    return nullptr;
   }
 
-  PyObject *xai_model = PyObject_GetAttrString(settings, "XAI_MODEL");
-  if (xai_model) {
-    abi_settings.xai_model = PyUnicode_AsUTF8(xai_model);
-    Py_DECREF(xai_model);
-  } else {
-    static const char *DEFAULT_MODEL = "grok-2-1212";
-    abi_settings.xai_model = DEFAULT_MODEL;
+  yai::ai::Limits limits;
+  CopySetting(settings, "YAI_AI_REQUESTS_PER_MINUTE",
+              limits.requests_per_minute);
+  CopySetting(settings, "YAI_AI_TOKENS_PER_MINUTE", limits.tokens_per_minute);
+  CopySetting(settings, "YAI_AI_CONCURRENCY", limits.concurrency);
+
+  // Process-wide, like the limits of the API account: the first module to
+  // load its settings configures it.
+  static std::once_flag configured;
+  std::call_once(configured,
+                 [&] { yai::ai::Scheduler::Instance().Configure(limits); });
+
+  if (!CopySetting(settings, "XAI_MODEL", abi_settings->xai_model))
+    abi_settings->xai_model = "grok-2-1212";
+
+  if (!CopySetting(settings, "YAI_ABI_CONNINFO", abi_settings->conninfo)) {
+    conio::Warning("YAI_ABI_CONNINFO not found in settings");
+    abi_settings->conninfo = "dbname=yai user=postgres";
   }
 
-  PyObject *conninfo = PyObject_GetAttrString(settings, "YAI_ABI_CONNINFO");
+  std::string system_prompt;
+  if (!CopySetting(settings, "YAI_SYSTEM_PROMPT", system_prompt))
+    system_prompt = "sinput";
+
+  abi_settings->system_prompt =
+      std::make_unique<yai::WatchedFile>(std::move(system_prompt));
 
-  if (conninfo) {
-    abi_settings.conninfo = PyUnicode_AsUTF8(conninfo);
-    Py_DECREF(conninfo);
-  } else {
-    conio::Warning("YAIB_ABI_CONNINFO not found in settings");
-    static const char *DEFAULT_CONNINFO = "dbname=yai user=postgres";
-    abi_settings.conninfo = DEFAULT_CONNINFO;
+  if (abi_settings->system_prompt->Load()) {
+    const std::string message = "System prompt " +
+                                abi_settings->system_prompt->path() + ": " +
+                                abi_settings->system_prompt->error();
+    conio::Warning(message.c_str());
   }
 
+  if (!CopySetting(settings, "YAI_STREAM_FLUSH_BYTES",
+                   abi_settings->stream_flush_bytes))
+    abi_settings->stream_flush_bytes = 256;
+
+  std::size_t flush_ms;
+  if (!CopySetting(settings, "YAI_STREAM_FLUSH_MS", flush_ms))
+    flush_ms = 30;
+
+  abi_settings->stream_flush_latency = std::chrono::milliseconds{flush_ms};
+
+  if (!CopySetting(settings, "YAI_SESSION_TOKEN_BUDGET",
+                   abi_settings->session_token_budget))
+    abi_settings->session_token_budget = 8192;
+
+  std::size_t idle_seconds;
+  if (!CopySetting(settings, "YAI_SESSION_IDLE_SECONDS", idle_seconds))
+    idle_seconds = 3600;
+
+  abi_settings->session_idle = std::chrono::seconds{idle_seconds};
+
+  if (!CopySetting(settings, "YAI_SUMMARY_CHUNK_BYTES",
+                   abi_settings->summary_chunk_bytes))
+    abi_settings->summary_chunk_bytes = 32 * 1024;
+
+  if (!CopySetting(settings, "YAI_SUMMARY_CONCURRENCY",
+                   abi_settings->summary_concurrency))
+    abi_settings->summary_concurrency = 4;
+
   Py_DECREF(settings);
-  Py_DECREF(dj_conf);
+
+  return abi_settings;
+}
+
+std::shared_ptr<const ABISettings> Settings(PyObject *module) {
+  ModuleState *state = static_cast<ModuleState *>(PyModule_GetState(module));
+
+  if (std::shared_ptr<const ABISettings> settings = state->settings.load())
+    return settings;
+
+  // Two threads may load at once; either copy will do.
+  std::shared_ptr<const ABISettings> settings = LoadSettings();
+  if (!settings)
+    return nullptr;
+
+  std::shared_ptr<const ABISettings> expected;
+  if (!state->settings.compare_exchange_strong(expected, settings))
+    return expected;
+
+  return settings;
+}
+
+int ExecModule(PyObject *module) {
+  new (PyModule_GetState(module)) ModuleState{};
+  return 0;
+}
+
+void FreeModule(void *module) {
+  if (void *state = PyModule_GetState(static_cast<PyObject *>(module)))
+    static_cast<ModuleState *>(state)->~ModuleState();
+}
+
+PyObject *CacheStats(PyObject *module, PyObject *) {
+  const std::shared_ptr<const ABISettings> settings = Settings(module);
+  if (!settings)
+    return nullptr;
+
+  const yai::cache::ResponseCache *cache = settings->xai->cache();
+  if (!cache)
+    Py_RETURN_NONE;
+
+  const yai::cache::Stats stats = cache->stats();
+
+  return Py_BuildValue(
+      "{sKsKsKsKsKsnsn}", "memory_hits",
+      static_cast<unsigned long long>(stats.memory_hits), "disk_hits",
+      static_cast<unsigned long long>(stats.disk_hits), "misses",
+      static_cast<unsigned long long>(stats.misses), "stores",
+      static_cast<unsigned long long>(stats.stores), "evictions",
+      static_cast<unsigned long long>(stats.evictions), "entries",
+      static_cast<Py_ssize_t>(stats.entries), "bytes",
+      static_cast<Py_ssize_t>(stats.bytes));
+}
+
+static PyObject *ClassStats(const yai::ai::SchedulerStats::Class &stats) {
+  return Py_BuildValue(
+      "{sKsnsdsd}", "admitted",
+      static_cast<unsigned long long>(stats.admitted), "waiting",
+      static_cast<Py_ssize_t>(stats.waiting), "queue_seconds",
+      std::chrono::duration<double>{stats.queue_time}.count(),
+      "max_queue_seconds",
+      std::chrono::duration<double>{stats.max_queue_time}.count());
+}
+
+PyObject *SchedulerStats(PyObject *, PyObject *) {
+  const yai::ai::SchedulerStats stats =
+      yai::ai::Scheduler::Instance().stats();
+
+  return Py_BuildValue("{sNsNsn}", "interactive",
+                       ClassStats(stats.interactive), "batch",
+                       ClassStats(stats.batch), "running",
+                       static_cast<Py_ssize_t>(stats.running));
+}
+
+} // namespace pyAi
+
+namespace pyAi {
+
+Executor &Executor::Instance() {
+  // Never destroyed: workers may still be blocked on I/O at exit.
+  static Executor *executor = new Executor;
+  return *executor;
+}
+
+Executor::Executor() {
+  const unsigned threads = std::max(8u, std::thread::hardware_concurrency());
+
+  for (unsigned i = 0; i < threads; ++i)
+    std::thread{&Executor::Loop, this}.detach();
+}
+
+void Executor::Push(std::unique_ptr<Task> task) {
+  {
+    std::lock_guard lock{mutex_};
+    tasks_.push_back(std::move(task));
+  }
+
+  ready_.notify_one();
+}
+
+void Executor::Loop() {
+  for (;;) {
+    std::unique_ptr<Task> task;
+
+    {
+      std::unique_lock lock{mutex_};
+      ready_.wait(lock, [this] { return !tasks_.empty(); });
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task->Run();
+  }
+}
+
+bool NewFuture(PyObject *&loop, PyObject *&future) {
+  PyObject *asyncio = PyImport_ImportModule("asyncio");
+  if (!asyncio)
+    return true;
+
+  loop = PyObject_CallMethod(asyncio, "get_running_loop", nullptr);
+  Py_DECREF(asyncio);
+
+  if (!loop)
+    return true;
+
+  future = PyObject_CallMethod(loop, "create_future", nullptr);
+
+  if (!future) {
+    Py_DECREF(loop);
+    return true;
+  }
 
   return false;
 }
 
+void Resolve(PyObject *loop, PyObject *future, PyObject *result) {
+  // Made per call: a function object may not be shared between
+  // interpreters.
+  PyObject *set_future = PyCFunction_New(&set_future_def, nullptr);
+
+  PyObject *exception = Py_None;
+  Py_INCREF(exception);
+
+  if (!result) {
+    Py_DECREF(exception);
+#if PY_VERSION_HEX >= 0x030C0000
+    exception = PyErr_GetRaisedException();
+#else
+    PyObject *type, *traceback;
+    PyErr_Fetch(&type, &exception, &traceback);
+    PyErr_NormalizeException(&type, &exception, &traceback);
+    if (traceback)
+      PyException_SetTraceback(exception, traceback);
+    Py_XDECREF(type);
+    Py_XDECREF(traceback);
+#endif
+    result = Py_None;
+    Py_INCREF(result);
+  }
+
+  PyObject *scheduled =
+      set_future ? PyObject_CallMethod(loop, "call_soon_threadsafe", "OOOO",
+                                       set_future, future, result, exception)
+                 : nullptr;
+
+  // The loop may be closed already; nobody is left to tell.
+  if (!scheduled)
+    PyErr_WriteUnraisable(future);
+
+  Py_XDECREF(scheduled);
+  Py_XDECREF(set_future);
+  Py_DECREF(exception);
+  Py_DECREF(result);
+  Py_DECREF(future);
+  Py_DECREF(loop);
+}
+
 } // namespace pyAi
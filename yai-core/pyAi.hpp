@@ -1,13 +1,233 @@
 #define PY_SSIZE_T_CLEAN
 
 #include <Python.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "yai-ai.hpp"
+#include "yai-mmap.hpp"
 
 namespace pyAi {
 
 struct ABISettings {
-  const char *xai_api_key, *xai_model, *conninfo;
+  // Shared by every module loading the same XAI_* and YAI_CACHE_* settings.
+  std::shared_ptr<const yai::ai::Client> xai;
+  std::unique_ptr<yai::WatchedFile> system_prompt;
+  std::string xai_model, conninfo;
+
+  // ProcessPartial coalesces streamed text into one callback per
+  // stream_flush_bytes or stream_flush_latency, whichever comes first.
+  std::size_t stream_flush_bytes;
+  std::chrono::milliseconds stream_flush_latency;
+
+  // Chat sessions send at most session_token_budget tokens of history and
+  // are dropped after session_idle without use.
+  std::size_t session_token_budget;
+  std::chrono::seconds session_idle;
+
+  // Bookings beyond summary_chunk_bytes of prompt are summarized in chunks,
+  // summary_concurrency at a time, and the partial summaries merged.
+  std::size_t summary_chunk_bytes, summary_concurrency;
+};
+
+// Per-module state of the ABI modules (PEP 489). Settings are read from
+// django.conf on first use, not at import.
+struct ModuleState {
+  std::atomic<std::shared_ptr<const ABISettings>> settings;
+};
+
+// The settings of module; null with an exception set when they cannot be
+// loaded.
+std::shared_ptr<const ABISettings> Settings(PyObject *module);
+
+// Py_mod_exec and m_free of the ABI modules, for m_size sizeof(ModuleState).
+int ExecModule(PyObject *module);
+
+void FreeModule(void *module);
+
+// CacheStats() of the ABI modules: the response cache counters as a dict,
+// or None when the cache is off.
+PyObject *CacheStats(PyObject *module, PyObject *);
+
+// SchedulerStats(): admissions, waiting calls and queue time per priority
+// class of the process-wide model call scheduler.
+PyObject *SchedulerStats(PyObject *, PyObject *);
+
+// A Python exception to raise later. Code running without the GIL records
+// the failure here and the caller raises it once the GIL is back.
+struct Error {
+  PyObject *type = nullptr;
+  std::string message;
+
+  bool Set(PyObject *error_type, std::string_view error_message) {
+    type = error_type;
+    message = error_message;
+    return true;
+  }
+
+  explicit operator bool() const { return type != nullptr; }
+
+  std::nullptr_t Raise() const {
+    PyErr_SetString(type, message.c_str());
+    return nullptr;
+  }
+};
+
+// A thread running without the GIL (detached, in free-threaded builds).
+// It reaches Python only through WithGIL.
+class ThreadState {
+public:
+  ThreadState(const ThreadState &) = delete;
+  ThreadState &operator=(const ThreadState &) = delete;
+
+  template <class F> decltype(auto) WithGIL(F &&f) {
+    struct Attach {
+      PyThreadState *&state;
+      explicit Attach(PyThreadState *&s) : state{s} {
+        PyEval_RestoreThread(state);
+      }
+      ~Attach() { state = PyEval_SaveThread(); }
+    } attach{state_};
+
+    return f();
+  }
+
+protected:
+  explicit ThreadState(PyThreadState *state) : state_{state} {}
+  ~ThreadState() = default;
+
+  PyThreadState *state_;
+};
+
+// Releases the GIL held by the calling thread for the lifetime of the
+// object.
+class AllowThreads : public ThreadState {
+public:
+  AllowThreads() : ThreadState{PyEval_SaveThread()} {}
+  ~AllowThreads() { PyEval_RestoreThread(state_); }
+};
+
+// A fresh thread state in interpreter interp for a native thread, created
+// detached and destroyed with the object.
+class ForeignThread : public ThreadState {
+public:
+  explicit ForeignThread(PyInterpreterState *interp)
+      : ThreadState{PyThreadState_New(interp)} {}
+  ~ForeignThread() {
+    PyEval_RestoreThread(state_);
+    PyThreadState_Clear(state_);
+    PyThreadState_DeleteCurrent();
+  }
 };
 
-bool InitSettings(ABISettings &abi_settings);
+// Fixed pool of native threads for the blocking half of awaitable calls.
+// It lives until the process exits.
+class Executor {
+public:
+  static Executor &Instance();
+
+  template <class F> void Post(F &&f) {
+    Push(std::make_unique<Job<std::decay_t<F>>>(std::forward<F>(f)));
+  }
+
+private:
+  struct Task {
+    virtual ~Task() = default;
+    virtual void Run() = 0;
+  };
+
+  template <class F> struct Job final : Task {
+    explicit Job(F &&fn) : f{std::move(fn)} {}
+    explicit Job(const F &fn) : f{fn} {}
+    void Run() override { f(); }
+    F f;
+  };
+
+  Executor();
+
+  void Push(std::unique_ptr<Task> task);
+
+  void Loop();
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::unique_ptr<Task>> tasks_;
+};
+
+// A new future on the running asyncio loop. Both are new references.
+bool NewFuture(PyObject *&loop, PyObject *&future);
+
+// Hands result, or the pending exception when result is null, to future
+// through loop.call_soon_threadsafe. Steals all three references; needs the
+// GIL.
+void Resolve(PyObject *loop, PyObject *future, PyObject *result);
+
+// Runs a call the way the synchronous entry points do: task.Run(thread)
+// without the GIL, then task.Finish() to build the result.
+template <class T> PyObject *Call(T &task) {
+  {
+    AllowThreads allow_threads;
+    task.Run(allow_threads);
+  }
+
+  return task.Finish();
+}
+
+// Awaitable flavour of Call: returns an asyncio future right away and runs
+// the task on the Executor, attached to the calling interpreter. Finish()
+// and the task destructor run there with the GIL held. A task with
+// OnLoop(loop) is told the loop before it starts.
+template <class T> PyObject *Await(std::unique_ptr<T> task) {
+  PyObject *loop, *future;
+  if (NewFuture(loop, future))
+    return nullptr;
+
+  if constexpr (requires { task->OnLoop(loop); })
+    task->OnLoop(loop);
+
+  Py_INCREF(future);
+
+  Executor::Instance().Post([task = std::move(task), loop, future,
+                             interp = PyInterpreterState_Get()]() mutable {
+    ForeignThread thread{interp};
+
+    task->Run(thread);
+
+    thread.WithGIL([&] {
+      Resolve(loop, future, task->Finish());
+      task.reset();
+    });
+  });
+
+  return future;
+}
+
+// Entry points over a task type T with a settings member and
+// bool Prepare(PyObject *arg), which unpacks the argument with the GIL
+// held, plus Run(ThreadState &) and Finish() as above.
+template <class T> PyObject *Sync(PyObject *module, PyObject *arg) {
+  T task;
+
+  if (!(task.settings = Settings(module)) || task.Prepare(arg))
+    return nullptr;
+
+  return Call(task);
+}
+
+template <class T> PyObject *Async(PyObject *module, PyObject *arg) {
+  std::unique_ptr<T> task = std::make_unique<T>();
+
+  if (!(task->settings = Settings(module)) || task->Prepare(arg))
+    return nullptr;
+
+  return Await(std::move(task));
+}
 
 } // namespace pyAi
@@ -0,0 +1,553 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <unistd.h>
+
+#include "yai-ai.hpp"
+
+// Runs the chat completions client against a local HTTP server: body deltas
+// handed on as they arrive, keep-alive reuse, the retry of a stale pooled
+// connection, timeouts and cancellation, also of a call still queued by the
+// Scheduler. Over TLS, the server presents self-signed certificates which
+// SSL_CERT_FILE makes trusted, and the client must refuse any other.
+
+namespace {
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace ssl = asio::ssl;
+namespace ai = yai::ai;
+
+using tcp = asio::ip::tcp;
+using TlsSocket = ssl::stream<tcp::socket &>;
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<unsigned> failures{0};
+
+static void Check(bool ok, std::string_view what) {
+  if (ok)
+    return;
+
+  ++failures;
+  std::cerr << "FAIL " << what << std::endl;
+}
+
+// A self-signed certificate for the IP address host, in PEM.
+struct Certificate {
+  std::string cert, key;
+};
+
+template <class Write> static std::string Pem(Write write) {
+  BIO *bio = BIO_new(BIO_s_mem());
+  write(bio);
+
+  char *data;
+  const long size = BIO_get_mem_data(bio, &data);
+  std::string pem{data, static_cast<std::size_t>(size)};
+  BIO_free(bio);
+
+  return pem;
+}
+
+static Certificate SelfSigned(const std::string &host) {
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  X509 *x509 = X509_new();
+
+  X509_set_version(x509, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+  X509_set_pubkey(x509, key);
+
+  X509_NAME *name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(
+      name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char *>(host.c_str()), -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+
+  X509V3_CTX ctx;
+  X509V3_set_ctx_nodb(&ctx);
+  X509V3_set_ctx(&ctx, x509, x509, nullptr, nullptr, 0);
+
+  const std::string alt_name = "IP:" + host;
+  for (const auto &[nid, value] :
+       {std::pair{NID_subject_alt_name, alt_name.c_str()},
+        std::pair{NID_basic_constraints, "critical,CA:TRUE"}}) {
+    X509_EXTENSION *extension = X509V3_EXT_conf_nid(nullptr, &ctx, nid, value);
+    X509_add_ext(x509, extension, -1);
+    X509_EXTENSION_free(extension);
+  }
+
+  X509_sign(x509, key, EVP_sha256());
+
+  Certificate certificate{
+      Pem([&](BIO *bio) { PEM_write_bio_X509(bio, x509); }),
+      Pem([&](BIO *bio) {
+        PEM_write_bio_PrivateKey(bio, key, nullptr, nullptr, 0, nullptr,
+                                 nullptr);
+      })};
+
+  X509_free(x509);
+  EVP_PKEY_free(key);
+
+  return certificate;
+}
+
+// Accepts connections on a loopback port and serves each on its own thread.
+// Stopping shuts every connection down, which ends a handler blocked on it.
+class Server {
+public:
+  using Handler = std::function<void(tcp::socket &)>;
+  using TlsHandler = std::function<void(TlsSocket &)>;
+
+  explicit Server(Handler handler) : Server{std::move(handler), std::nullopt} {}
+
+  // Serves TLS with certificate; handler runs once the handshake is done.
+  Server(const Certificate &certificate, TlsHandler handler)
+      : Server{[this, handler = std::move(handler)](tcp::socket &socket) {
+                 TlsSocket stream{socket, *tls_};
+                 beast::error_code ec;
+                 stream.handshake(ssl::stream_base::server, ec);
+                 if (!ec)
+                   handler(stream);
+               },
+               Context(certificate)} {}
+
+  ~Server() {
+    stopping_ = true;
+
+    beast::error_code ec;
+    tcp::socket wake{io_};
+    wake.connect(acceptor_.local_endpoint(), ec);
+    thread_.join();
+
+    std::lock_guard lock{mutex_};
+    for (const std::shared_ptr<tcp::socket> &socket : sockets_)
+      socket->shutdown(tcp::socket::shutdown_both, ec);
+    for (std::thread &connection : connections_)
+      connection.join();
+  }
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  std::string url() const {
+    return (tls_ ? "https" : "http") + std::string{"://127.0.0.1:"} +
+           std::to_string(acceptor_.local_endpoint().port()) + "/v1";
+  }
+
+  unsigned accepted() const { return accepted_; }
+
+private:
+  Server(Handler handler, std::optional<ssl::context> tls)
+      : acceptor_{io_, {asio::ip::make_address("127.0.0.1"), 0}},
+        tls_{std::move(tls)}, handler_{std::move(handler)},
+        thread_{[this] { Accept(); }} {}
+
+  static ssl::context Context(const Certificate &certificate) {
+    ssl::context tls{ssl::context::tls_server};
+    tls.use_certificate_chain(asio::buffer(certificate.cert));
+    tls.use_private_key(asio::buffer(certificate.key), ssl::context::pem);
+    return tls;
+  }
+
+  void Accept() {
+    for (;;) {
+      auto socket = std::make_shared<tcp::socket>(io_);
+      beast::error_code ec;
+      acceptor_.accept(*socket, ec);
+
+      if (stopping_)
+        return;
+      if (ec)
+        continue;
+
+      ++accepted_;
+      std::lock_guard lock{mutex_};
+      sockets_.push_back(socket);
+      connections_.emplace_back([this, socket] { handler_(*socket); });
+    }
+  }
+
+  asio::io_context io_;
+  tcp::acceptor acceptor_;
+  std::optional<ssl::context> tls_;
+  Handler handler_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<unsigned> accepted_{0};
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<tcp::socket>> sockets_;
+  std::vector<std::thread> connections_;
+  std::thread thread_;
+};
+
+// Returns true once the client closed the connection.
+template <class Socket>
+static bool Read(Socket &socket, beast::flat_buffer &buffer) {
+  http::request<http::string_body> request;
+  beast::error_code ec;
+  http::read(socket, buffer, request, ec);
+  return static_cast<bool>(ec);
+}
+
+template <class Socket>
+static void Complete(Socket &socket, std::string_view content) {
+  http::response<http::string_body> response{http::status::ok, 11};
+  response.set(http::field::content_type, "application/json");
+  response.keep_alive(true);
+  response.body() = R"({"choices":[{"message":{"content":")" +
+                    std::string{content} + R"("}}]})";
+  response.prepare_payload();
+
+  beast::error_code ec;
+  http::write(socket, response, ec);
+}
+
+template <class Socket> static void StreamHeader(Socket &socket) {
+  http::response<http::empty_body> response{http::status::ok, 11};
+  response.set(http::field::content_type, "text/event-stream");
+  response.keep_alive(true);
+  response.chunked(true);
+
+  http::response_serializer<http::empty_body> serializer{response};
+  beast::error_code ec;
+  http::write_header(socket, serializer, ec);
+}
+
+template <class Socket>
+static void StreamData(Socket &socket, std::string_view data) {
+  const std::string event = "data: " + std::string{data} + "\n\n";
+  beast::error_code ec;
+  asio::write(socket, http::make_chunk(asio::buffer(event)), ec);
+}
+
+static std::string Delta(std::string_view content) {
+  return R"({"choices":[{"delta":{"content":")" + std::string{content} +
+         R"("}}]})";
+}
+
+// Blocks until the server is stopped or the client goes away.
+template <class Socket> static void Stall(Socket &socket) {
+  char byte;
+  beast::error_code ec;
+  socket.read_some(asio::buffer(&byte, 1), ec);
+}
+
+static ai::Chat Ask(std::string question) {
+  ai::Chat chat{"test", {}, ai::Priority::INTERACTIVE};
+  chat.AddU(std::move(question));
+  return chat;
+}
+
+static void KeepAlive() {
+  Server server{[](tcp::socket &socket) {
+    beast::flat_buffer buffer;
+    while (!Read(socket, buffer))
+      Complete(socket, "pong");
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  std::string answer, error;
+
+  for (const char *question : {"ping 1", "ping 2", "ping 3"}) {
+    Check(!client->Complete(Ask(question), answer, error),
+          "keep-alive complete");
+    Check(answer == "pong", "keep-alive answer");
+  }
+
+  Check(server.accepted() == 1, "keep-alive reuses the connection");
+}
+
+static void StaleRetry() {
+  // Answers two requests at once, each on its own connection, then closes
+  // both without telling the client; the pool is left with two stale
+  // connections, and only a new one can answer the next request.
+  std::atomic<unsigned> arrived{0};
+
+  Server server{[&](tcp::socket &socket) {
+    beast::flat_buffer buffer;
+    if (!Read(socket, buffer)) {
+      ++arrived;
+      for (int i = 0; arrived < 2 && i < 500; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      Complete(socket, "pong");
+    }
+
+    beast::error_code ec;
+    socket.shutdown(tcp::socket::shutdown_both, ec);
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  std::string answer, error;
+
+  std::thread other{[&] {
+    std::string other_answer, other_error;
+    Check(!client->Complete(Ask("ping 1"), other_answer, other_error),
+          "stale complete");
+  }};
+  Check(!client->Complete(Ask("ping 2"), answer, error), "stale complete");
+  other.join();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds{100});
+
+  Check(!client->Complete(Ask("ping 3"), answer, error), "stale retry");
+  Check(answer == "pong", "stale answer");
+  Check(server.accepted() == 3, "stale connection replaced");
+}
+
+static void EachDelta() {
+  // Holds the rest of the answer back until the first delta got through.
+  std::promise<void> first;
+  std::future<void> received = first.get_future();
+
+  Server server{[&](tcp::socket &socket) {
+    beast::flat_buffer buffer;
+    if (Read(socket, buffer))
+      return;
+
+    StreamHeader(socket);
+    StreamData(socket, Delta("Hello"));
+    const bool released =
+        received.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+    Check(released, "first delta handed on before the rest arrived");
+
+    StreamData(socket, Delta(", world"));
+    StreamData(socket, "[DONE]");
+
+    beast::error_code ec;
+    asio::write(socket, http::make_chunk_last(), ec);
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  std::string answer, error;
+
+  const bool failed = client->Stream(
+      Ask("hello"),
+      [&](std::string_view delta) {
+        if (answer.empty())
+          first.set_value();
+        answer.append(delta);
+        return true;
+      },
+      error);
+
+  Check(!failed, "stream");
+  Check(answer == "Hello, world", "stream answer");
+}
+
+static void Timeout() {
+  Server server{[](tcp::socket &socket) {
+    beast::flat_buffer buffer;
+    if (!Read(socket, buffer))
+      Stall(socket);
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(
+      server.url(), "", nullptr, std::chrono::seconds{1});
+  std::string answer, error;
+
+  const Clock::time_point start = Clock::now();
+  Check(client->Complete(Ask("ping"), answer, error), "timeout fails");
+  Check(error.ends_with("timed out"), "timeout error");
+  Check(Clock::now() - start < std::chrono::seconds{5}, "timeout in time");
+}
+
+static void Cancel() {
+  Server server{[](tcp::socket &socket) {
+    beast::flat_buffer buffer;
+    if (Read(socket, buffer))
+      return;
+
+    StreamHeader(socket);
+    Stall(socket);
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  ai::CancelToken cancel;
+  std::string error;
+
+  std::thread canceller{[&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    cancel.Cancel();
+  }};
+
+  const Clock::time_point start = Clock::now();
+  const bool failed = client->Stream(
+      Ask("hello"), [](std::string_view) { return true; }, error, &cancel);
+  canceller.join();
+
+  Check(failed, "cancel fails");
+  Check(error == "Cancelled", "cancel error");
+  Check(Clock::now() - start < std::chrono::seconds{5}, "cancel in time");
+}
+
+static void CancelQueued() {
+  Server server{[](tcp::socket &) {}};
+
+  ai::Scheduler &scheduler = ai::Scheduler::Instance();
+  scheduler.Configure({0, 0, 1});
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  ai::CancelToken cancel;
+  std::string error;
+  bool failed = false;
+  std::promise<void> returned;
+  std::thread stream;
+
+  {
+    // Holds the only slot, so the stream waits in the queue.
+    ai::Scheduler::Ticket held =
+        scheduler.Acquire(ai::Priority::INTERACTIVE, 0);
+
+    stream = std::thread{[&] {
+      failed = client->Stream(
+          Ask("hello"), [](std::string_view) { return true; }, error,
+          &cancel);
+      returned.set_value();
+    }};
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    Check(scheduler.stats().interactive.waiting == 1, "queued");
+
+    cancel.Cancel();
+    Check(returned.get_future().wait_for(std::chrono::seconds{5}) ==
+              std::future_status::ready,
+          "queued stream returns on cancel");
+  }
+
+  stream.join();
+
+  Check(failed && error == "Cancelled", "queued stream cancelled");
+  Check(scheduler.stats().interactive.waiting == 0, "left the queue");
+  Check(server.accepted() == 0, "cancelled stream never sent");
+  Check(static_cast<bool>(scheduler.Acquire(ai::Priority::INTERACTIVE, 0)),
+        "queue moves on");
+
+  scheduler.Configure({});
+}
+
+static void Tls(const Certificate &certificate) {
+  // Answers the first request whole and streams the second.
+  Server server{certificate, [](TlsSocket &socket) {
+    beast::flat_buffer buffer;
+    if (Read(socket, buffer))
+      return;
+    Complete(socket, "pong");
+
+    if (Read(socket, buffer))
+      return;
+    StreamHeader(socket);
+    StreamData(socket, Delta("Hello"));
+    StreamData(socket, "[DONE]");
+
+    beast::error_code ec;
+    asio::write(socket, http::make_chunk_last(), ec);
+    Stall(socket);
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(server.url(), "");
+  std::string answer, error;
+
+  Check(!client->Complete(Ask("ping"), answer, error), "tls complete");
+  Check(answer == "pong", "tls answer");
+
+  answer.clear();
+  const bool failed = client->Stream(
+      Ask("hello"),
+      [&](std::string_view delta) {
+        answer.append(delta);
+        return true;
+      },
+      error);
+
+  Check(!failed, "tls stream");
+  Check(answer == "Hello", "tls stream answer");
+  Check(server.accepted() == 1, "tls keep-alive reuses the connection");
+}
+
+// The client must not send anything over a connection it cannot verify.
+static void TlsRefused(const Certificate &certificate, std::string_view what) {
+  std::atomic<bool> requested{false};
+
+  Server server{certificate, [&](TlsSocket &socket) {
+    beast::flat_buffer buffer;
+    if (!Read(socket, buffer))
+      requested = true;
+  }};
+
+  const std::unique_ptr<ai::Client> client = ai::Client::Make(
+      server.url(), "", nullptr, std::chrono::seconds{5});
+  std::string answer, error;
+
+  Check(client->Complete(Ask("ping"), answer, error), what);
+  Check(error.find("certificate verify failed") != std::string::npos, what);
+  Check(!requested, what);
+}
+
+// Trusts a certificate for 127.0.0.1 and one for another host, both in a
+// bundle named by SSL_CERT_FILE, which the client's pool reads when it is
+// first used.
+static std::filesystem::path Trust(const Certificate &local,
+                                   const Certificate &other) {
+  const std::filesystem::path bundle =
+      std::filesystem::temp_directory_path() /
+      ("yai-ai-test-" + std::to_string(getpid()) + ".pem");
+
+  std::ofstream{bundle} << local.cert << other.cert;
+  setenv("SSL_CERT_FILE", bundle.c_str(), 1);
+
+  return bundle;
+}
+
+} // namespace
+
+int main() {
+  const Certificate local = SelfSigned("127.0.0.1");
+  const Certificate other = SelfSigned("127.0.0.2");
+  const Certificate untrusted = SelfSigned("127.0.0.1");
+  const std::filesystem::path bundle = Trust(local, other);
+
+  KeepAlive();
+  StaleRetry();
+  EachDelta();
+  Timeout();
+  Cancel();
+  CancelQueued();
+  Tls(local);
+  TlsRefused(untrusted, "untrusted certificate refused");
+  TlsRefused(other, "certificate for another host refused");
+
+  std::filesystem::remove(bundle);
+
+  if (failures) {
+    std::cerr << failures << " failures" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,639 @@
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <variant>
+
+#include <sys/socket.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/json.hpp>
+
+#include "yai-ai.hpp"
+#include "yai-flatmap.hpp"
+#include "yai-session.hpp"
+
+namespace yai::ai {
+
+namespace {
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace ssl = asio::ssl;
+
+using Plain = beast::tcp_stream;
+using Tls = beast::ssl_stream<beast::tcp_stream>;
+
+// Each connection runs its own io_context, so that a thread can wait on one
+// operation with a deadline without running the handlers of another.
+struct Connection {
+  asio::io_context io;
+  std::variant<Plain, Tls> stream;
+  beast::flat_buffer buffer;
+
+  template <std::size_t I, class... Args>
+  explicit Connection(std::in_place_index_t<I> index, Args &&...args)
+      : stream{index, io, std::forward<Args>(args)...} {}
+};
+
+// Runs one asynchronous operation on stream to completion. The stream closes
+// its socket when the operation takes longer than timeout and the operation
+// fails with beast::error::timeout.
+template <class Stream, class Initiate>
+static void Run(asio::io_context &io, Stream &stream,
+                std::chrono::seconds timeout, beast::error_code &ec,
+                Initiate &&initiate) {
+  beast::get_lowest_layer(stream).expires_after(timeout);
+  initiate([&ec](beast::error_code result, auto &&...) { ec = result; });
+
+  io.restart();
+  io.run();
+}
+
+static std::string Reason(const beast::error_code &ec) {
+  return ec == beast::error::timeout ? "timed out" : ec.message();
+}
+
+// Idle keep-alive connections by origin. Connections are used by one
+// thread at a time: Acquire takes one out and Release puts it back once its
+// response was read to the end.
+class Pool {
+public:
+  static Pool &Instance() {
+    // Never destroyed: connections may still be in use at exit.
+    static Pool *pool = new Pool;
+    return *pool;
+  }
+
+  // With fresh, or without an idle connection to origin, opens a new one.
+  std::unique_ptr<Connection> Acquire(const Endpoint &endpoint,
+                                      const std::string &origin,
+                                      std::chrono::seconds timeout, bool fresh,
+                                      bool &reused, std::string &error) {
+    if (!fresh) {
+      std::lock_guard lock{mutex_};
+      std::vector<std::unique_ptr<Connection>> *idle = idle_.Find(origin);
+
+      if (idle && !idle->empty()) {
+        std::unique_ptr<Connection> connection = std::move(idle->back());
+        idle->pop_back();
+        reused = true;
+        return connection;
+      }
+    }
+
+    reused = false;
+    return Open(endpoint, timeout, error);
+  }
+
+  void Release(const std::string &origin,
+               std::unique_ptr<Connection> connection) {
+    std::lock_guard lock{mutex_};
+    std::vector<std::unique_ptr<Connection>> &idle =
+        *idle_.Emplace(origin, {}).first;
+
+    if (idle.size() < MAX_IDLE)
+      idle.push_back(std::move(connection));
+  }
+
+private:
+  static constexpr std::size_t MAX_IDLE = 16;
+
+  Pool() : tls_{ssl::context::tls_client} {
+    tls_.set_default_verify_paths();
+    tls_.set_verify_mode(ssl::verify_peer);
+  }
+
+  std::unique_ptr<Connection> Open(const Endpoint &endpoint,
+                                   std::chrono::seconds timeout,
+                                   std::string &error) {
+    std::unique_ptr<Connection> connection;
+
+    if (endpoint.tls) {
+      connection = std::make_unique<Connection>(std::in_place_index<1>, tls_);
+      Tls &stream = std::get<Tls>(connection->stream);
+
+      if (!SSL_set_tlsext_host_name(stream.native_handle(),
+                                    endpoint.host.c_str())) {
+        error = "Error setting TLS host name";
+        return nullptr;
+      }
+
+      stream.set_verify_callback(ssl::host_name_verification(endpoint.host));
+    } else {
+      connection = std::make_unique<Connection>(std::in_place_index<0>);
+    }
+
+    beast::error_code ec;
+    asio::ip::tcp::resolver resolver{connection->io};
+    const auto results = resolver.resolve(endpoint.host, endpoint.port, ec);
+
+    if (ec) {
+      error = "Error resolving " + endpoint.host + ": " + ec.message();
+      return nullptr;
+    }
+
+    std::visit(
+        [&](auto &stream) {
+          auto &lowest = beast::get_lowest_layer(stream);
+
+          Run(connection->io, stream, timeout, ec, [&](auto handler) {
+            lowest.async_connect(results, handler);
+          });
+          if (!ec)
+            lowest.socket().set_option(asio::ip::tcp::no_delay{true}, ec);
+        },
+        connection->stream);
+
+    if (!ec && endpoint.tls) {
+      Tls &stream = std::get<Tls>(connection->stream);
+
+      Run(connection->io, stream, timeout, ec, [&](auto handler) {
+        stream.async_handshake(ssl::stream_base::client, handler);
+      });
+    }
+
+    if (ec) {
+      error = "Error connecting to " + endpoint.origin() + ": " + Reason(ec);
+      return nullptr;
+    }
+
+    return connection;
+  }
+
+  ssl::context tls_;
+
+  std::mutex mutex_;
+  FlatMap<std::string, std::vector<std::unique_ptr<Connection>>> idle_;
+};
+
+using Request = http::request<http::string_body>;
+using Parser = http::response_parser<http::buffer_body>;
+using OnBody = std::function<bool(std::string_view)>;
+
+// Keeps a connection attached to a cancel token while in use.
+struct Attachment {
+  CancelToken *token;
+
+  ~Attachment() {
+    if (token)
+      token->Detach();
+  }
+};
+
+// Sends request and hands the response body to on_body as it arrives;
+// on_body returns false to abandon the response. Each connect, write and
+// read fails after timeout without progress. A pooled connection that the
+// server closed while idle is retried once on a newly opened one.
+static bool Exchange(const Endpoint &endpoint, const Request &request,
+                     std::chrono::seconds timeout, unsigned &status,
+                     const OnBody &on_body, std::string &error,
+                     CancelToken *cancel) {
+  Pool &pool = Pool::Instance();
+  const std::string origin = endpoint.origin();
+
+  for (bool retry = true;; retry = false) {
+    bool reused;
+    std::unique_ptr<Connection> connection =
+        pool.Acquire(endpoint, origin, timeout, !retry, reused, error);
+    if (!connection)
+      return true;
+
+    const int fd = std::visit(
+        [](auto &stream) {
+          return beast::get_lowest_layer(stream).socket().native_handle();
+        },
+        connection->stream);
+
+    if (cancel && cancel->Attach(fd)) {
+      error = "Cancelled";
+      return true;
+    }
+
+    Attachment attachment{cancel};
+    beast::error_code ec;
+    Parser parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+
+    std::visit(
+        [&](auto &stream) {
+          Run(connection->io, stream, timeout, ec, [&](auto handler) {
+            http::async_write(stream, request, handler);
+          });
+          if (!ec)
+            Run(connection->io, stream, timeout, ec, [&](auto handler) {
+              http::async_read_header(stream, connection->buffer, parser,
+                                      handler);
+            });
+        },
+        connection->stream);
+
+    if (cancel && cancel->cancelled()) {
+      error = "Cancelled";
+      return true;
+    }
+
+    if (ec) {
+      if (reused && retry)
+        continue;
+      error = "Error requesting " + origin + ": " + Reason(ec);
+      return true;
+    }
+
+    status = parser.get().result_int();
+
+    char chunk[8192];
+    bool abandoned = false;
+
+    // async_read_some completes as soon as some of the body arrived, so
+    // each delta of a stream is handed on without waiting for the chunk to
+    // fill.
+    while (!parser.is_done()) {
+      parser.get().body().data = chunk;
+      parser.get().body().size = sizeof(chunk);
+
+      std::visit(
+          [&](auto &stream) {
+            Run(connection->io, stream, timeout, ec, [&](auto handler) {
+              http::async_read_some(stream, connection->buffer, parser,
+                                    handler);
+            });
+          },
+          connection->stream);
+
+      if (ec == http::error::need_buffer)
+        ec = {};
+
+      if (cancel && cancel->cancelled()) {
+        error = "Cancelled";
+        return true;
+      }
+
+      if (ec) {
+        error = "Error reading from " + origin + ": " + Reason(ec);
+        return true;
+      }
+
+      const std::size_t size = sizeof(chunk) - parser.get().body().size;
+
+      if (size && !on_body({chunk, size})) {
+        abandoned = true;
+        break;
+      }
+    }
+
+    // A cancel racing with the end of the response may have shut the
+    // connection down already.
+    if (cancel) {
+      cancel->Detach();
+      attachment.token = nullptr;
+      abandoned = abandoned || cancel->cancelled();
+    }
+
+    if (!abandoned && parser.get().keep_alive())
+      pool.Release(origin, std::move(connection));
+
+    return false;
+  }
+}
+
+static const char *RoleName(Role role) {
+  switch (role) {
+  case Role::SYSTEM:
+    return "system";
+  case Role::USER:
+    return "user";
+  case Role::ASSISTANT:
+    return "assistant";
+  }
+  return "user";
+}
+
+static std::string Serialize(const Chat &chat, bool stream) {
+  boost::json::array messages;
+  for (const Message &message : chat.messages)
+    messages.push_back(boost::json::object{{"role", RoleName(message.role)},
+                                           {"content", message.content}});
+
+  const boost::json::object body{{"model", chat.model},
+                                 {"messages", std::move(messages)},
+                                 {"stream", stream}};
+
+  return boost::json::serialize(body);
+}
+
+static Request MakeRequest(const Endpoint &endpoint, const std::string &key,
+                           std::string body, bool stream) {
+  Request request{http::verb::post, endpoint.prefix + "/chat/completions",
+                  11};
+  request.set(http::field::host,
+              endpoint.port == (endpoint.tls ? "443" : "80")
+                  ? endpoint.host
+                  : endpoint.host + ':' + endpoint.port);
+  request.set(http::field::authorization, "Bearer " + key);
+  request.set(http::field::content_type, "application/json");
+  request.set(http::field::accept,
+              stream ? "text/event-stream" : "application/json");
+  request.keep_alive(true);
+  request.body() = std::move(body);
+  request.prepare_payload();
+
+  return request;
+}
+
+// choices[0].<field>.content of a completion payload.
+static const boost::json::string *Content(const boost::json::value &payload,
+                                          std::string_view field) {
+  const boost::json::object *object = payload.if_object();
+  if (!object)
+    return nullptr;
+
+  const boost::json::value *choices = object->if_contains("choices");
+  if (!choices || !choices->if_array() || choices->if_array()->empty())
+    return nullptr;
+
+  const boost::json::object *choice = choices->if_array()->front().if_object();
+  if (!choice)
+    return nullptr;
+
+  const boost::json::value *part = choice->if_contains(field);
+  if (!part || !part->if_object())
+    return nullptr;
+
+  const boost::json::value *content = part->if_object()->if_contains("content");
+  return content ? content->if_string() : nullptr;
+}
+
+static std::size_t PromptTokens(const Chat &chat) {
+  std::size_t tokens = 0;
+  for (const Message &message : chat.messages)
+    tokens += session::EstimateTokens(message.content);
+  return tokens;
+}
+
+static void SetStatusError(unsigned status, std::string_view body,
+                           std::string &error) {
+  static constexpr std::size_t MAX_BODY = 256;
+
+  error = "xAI API error " + std::to_string(status) + ": ";
+  error.append(body.substr(0, MAX_BODY));
+}
+
+} // namespace
+
+bool Endpoint::Parse(std::string_view url, Endpoint &endpoint) {
+  if (url.starts_with("https://")) {
+    endpoint.tls = true;
+    url.remove_prefix(8);
+  } else if (url.starts_with("http://")) {
+    endpoint.tls = false;
+    url.remove_prefix(7);
+  } else {
+    return true;
+  }
+
+  const std::size_t slash = url.find('/');
+  std::string_view authority = url.substr(0, slash);
+  std::string_view prefix =
+      slash == std::string_view::npos ? "" : url.substr(slash);
+
+  while (prefix.ends_with('/'))
+    prefix.remove_suffix(1);
+
+  const std::size_t colon = authority.find(':');
+
+  if (colon == std::string_view::npos) {
+    endpoint.port = endpoint.tls ? "443" : "80";
+  } else {
+    endpoint.port = authority.substr(colon + 1);
+    authority = authority.substr(0, colon);
+  }
+
+  endpoint.host = authority;
+  endpoint.prefix = prefix;
+
+  return endpoint.host.empty() || endpoint.port.empty();
+}
+
+void CancelToken::Cancel() {
+  {
+    std::lock_guard lock{mutex_};
+    cancelled_.store(true, std::memory_order_release);
+
+    if (fd_ >= 0)
+      shutdown(fd_, SHUT_RDWR);
+  }
+
+  // The call may still be queued for admission.
+  Scheduler::Instance().Interrupt();
+}
+
+bool CancelToken::Attach(int fd) {
+  std::lock_guard lock{mutex_};
+
+  if (cancelled())
+    return true;
+
+  fd_ = fd;
+  return false;
+}
+
+void CancelToken::Detach() {
+  std::lock_guard lock{mutex_};
+  fd_ = -1;
+}
+
+std::string Endpoint::origin() const {
+  return (tls ? "https://" : "http://") + host + ':' + port;
+}
+
+std::unique_ptr<Client>
+Client::Make(std::string_view base_url, std::string api_key,
+             std::unique_ptr<cache::ResponseCache> cache,
+             std::chrono::seconds timeout) {
+  Endpoint endpoint;
+  if (Endpoint::Parse(base_url, endpoint))
+    return nullptr;
+
+  return std::unique_ptr<Client>{new Client{
+      std::move(endpoint), std::move(api_key), std::move(cache), timeout}};
+}
+
+bool Client::Complete(const Chat &chat, std::string &answer,
+                      std::string &error) const {
+  std::string request = Serialize(chat, false);
+  const cache::Key key = cache::Hash(request);
+
+  if (cache_) {
+    if (std::optional<std::string> cached = cache_->Find(key)) {
+      answer = std::move(*cached);
+      return false;
+    }
+  }
+
+  const std::shared_ptr<const Completion> completion = flights_.Do(key, [&] {
+    Completion result{true, {}, {}};
+    Scheduler::Ticket ticket =
+        Scheduler::Instance().Acquire(chat.priority, PromptTokens(chat));
+    unsigned status = 0;
+    std::string body;
+
+    if (Exchange(
+            endpoint_,
+            MakeRequest(endpoint_, api_key_, std::move(request), false),
+            timeout_, status,
+            [&](std::string_view chunk) {
+              body.append(chunk);
+              return true;
+            },
+            result.error, nullptr))
+      return result;
+
+    if (status != 200) {
+      SetStatusError(status, body, result.error);
+      return result;
+    }
+
+    boost::json::error_code ec;
+    const boost::json::value payload = boost::json::parse(body, ec);
+    const boost::json::string *content =
+        ec ? nullptr : Content(payload, "message");
+
+    if (!content) {
+      result.error = "Error parsing completion";
+      return result;
+    }
+
+    result.failed = false;
+    result.answer.assign(content->data(), content->size());
+    ticket.Charge(session::EstimateTokens(result.answer));
+
+    if (cache_)
+      cache_->Put(key, result.answer);
+
+    return result;
+  });
+
+  if (completion->failed) {
+    error = completion->error;
+    return true;
+  }
+
+  answer = completion->answer;
+
+  return false;
+}
+
+bool Client::Stream(const Chat &chat, const OnDelta &on_delta,
+                    std::string &error, CancelToken *cancel) const {
+  // Keyed like the equivalent Complete request; a hit is replayed as a
+  // single delta.
+  cache::Key key;
+  std::string answer;
+
+  if (cache_) {
+    key = cache::Hash(Serialize(chat, false));
+
+    if (std::optional<std::string> cached = cache_->Find(key)) {
+      on_delta(*cached);
+      return false;
+    }
+  }
+
+  unsigned status = 0;
+  std::string pending;
+  bool done = false, stopped = false;
+
+  // Server-sent events: one "data: {...}" line per chunk, then
+  // "data: [DONE]".
+  const OnBody on_body = [&](std::string_view chunk) {
+    if (done)
+      return true;
+
+    pending.append(chunk);
+
+    if (status != 200)
+      return true;
+
+    std::size_t start = 0, end;
+
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      std::string_view line{pending.data() + start, end - start};
+      start = end + 1;
+
+      if (line.ends_with('\r'))
+        line.remove_suffix(1);
+
+      if (!line.starts_with("data:"))
+        continue;
+
+      line.remove_prefix(5);
+      if (line.starts_with(' '))
+        line.remove_prefix(1);
+
+      if (line == "[DONE]") {
+        done = true;
+        break;
+      }
+
+      boost::json::error_code ec;
+      const boost::json::value payload = boost::json::parse(line, ec);
+      const boost::json::string *delta =
+          ec ? nullptr : Content(payload, "delta");
+
+      if (!delta)
+        continue;
+
+      answer.append(delta->data(), delta->size());
+
+      if (!delta->empty() && !on_delta({delta->data(), delta->size()})) {
+        stopped = true;
+        return false;
+      }
+    }
+
+    pending.erase(0, start);
+
+    return true;
+  };
+
+  Scheduler::Ticket ticket =
+      Scheduler::Instance().Acquire(chat.priority, PromptTokens(chat), cancel);
+
+  if (!ticket) {
+    error = "Cancelled";
+    return true;
+  }
+
+  const bool failed = Exchange(
+      endpoint_, MakeRequest(endpoint_, api_key_, Serialize(chat, true), true),
+      timeout_, status, on_body, error, cancel);
+
+  ticket.Charge(session::EstimateTokens(answer));
+
+  if (failed)
+    return true;
+
+  if (status != 200) {
+    SetStatusError(status, pending, error);
+    return true;
+  }
+
+  if (!stopped && !done) {
+    error = "Stream ended before [DONE]";
+    return true;
+  }
+
+  if (cache_ && !stopped)
+    cache_->Put(key, answer);
+
+  return false;
+}
+
+} // namespace yai::ai
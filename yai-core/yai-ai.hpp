@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "yai-cache.hpp"
+#include "yai-scheduler.hpp"
+#include "yai-singleflight.hpp"
+
+namespace yai::ai {
+
+enum class Role : std::uint8_t { SYSTEM, USER, ASSISTANT };
+
+struct Message {
+  Role role;
+  std::string content;
+};
+
+// A chat completion request, mirroring the xAI messages API. The priority
+// is for the scheduler only and is not sent.
+struct Chat {
+  std::string model;
+  std::vector<Message> messages;
+  Priority priority = Priority::BATCH;
+
+  void AddS(std::string content) {
+    messages.push_back({Role::SYSTEM, std::move(content)});
+  }
+
+  void AddU(std::string content) {
+    messages.push_back({Role::USER, std::move(content)});
+  }
+
+  void AddA(std::string content) {
+    messages.push_back({Role::ASSISTANT, std::move(content)});
+  }
+};
+
+// Receives each streamed content delta; returning false stops the stream.
+using OnDelta = std::function<bool(std::string_view)>;
+
+// Aborts a Stream call from any thread: a call still queued by the
+// Scheduler leaves the queue, a read blocked on its connection returns at
+// once, the call fails with "Cancelled" and the connection is closed
+// instead of going back to the pool.
+class CancelToken {
+public:
+  void Cancel();
+
+  bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+  // Used by the client around each request: Attach returns true, attaching
+  // nothing, when already cancelled.
+  bool Attach(int fd);
+  void Detach();
+
+private:
+  std::atomic<bool> cancelled_{false};
+  std::mutex mutex_;
+  int fd_ = -1;
+};
+
+// scheme://host[:port][/prefix], with scheme http or https.
+struct Endpoint {
+  bool tls = true;
+  std::string host, port, prefix;
+
+  // Returns true when url is not a valid endpoint.
+  static bool Parse(std::string_view url, Endpoint &endpoint);
+
+  std::string origin() const;
+};
+
+// Chat completions client. It holds no connection of its own: each call
+// leases a keep-alive connection from the process-wide pool, so one client
+// may be shared by any number of threads. With a cache, a request identical
+// to an earlier one is answered from it. Identical Complete calls running
+// at once share a single upstream request. Upstream requests are admitted
+// by the process-wide Scheduler.
+//
+// Servers are verified against OpenSSL's default trust store, which
+// SSL_CERT_FILE and SSL_CERT_DIR can point elsewhere.
+//
+// It replaces the xai-cpp client, which opened a connection per client with
+// no way to share it, point it at another base URL, bound a request in time
+// or cancel a stream; yai-ai-test covers those parts against a local server,
+// over plain HTTP and TLS.
+class Client {
+public:
+  // Null when base_url is not a valid endpoint. A connect, write or read
+  // making no progress for timeout fails the request.
+  static std::unique_ptr<Client>
+  Make(std::string_view base_url, std::string api_key,
+       std::unique_ptr<cache::ResponseCache> cache = nullptr,
+       std::chrono::seconds timeout = std::chrono::seconds{120});
+
+  // Returns true on error, with the reason in error.
+  bool Complete(const Chat &chat, std::string &answer,
+                std::string &error) const;
+
+  bool Stream(const Chat &chat, const OnDelta &on_delta, std::string &error,
+              CancelToken *cancel = nullptr) const;
+
+  const Endpoint &endpoint() const { return endpoint_; }
+
+  // Null without a cache.
+  const cache::ResponseCache *cache() const { return cache_.get(); }
+
+private:
+  Client(Endpoint endpoint, std::string api_key,
+         std::unique_ptr<cache::ResponseCache> cache,
+         std::chrono::seconds timeout)
+      : endpoint_{std::move(endpoint)}, api_key_{std::move(api_key)},
+        cache_{std::move(cache)}, timeout_{timeout} {}
+
+  struct Completion {
+    bool failed;
+    std::string answer, error;
+  };
+
+  Endpoint endpoint_;
+  std::string api_key_;
+  std::unique_ptr<cache::ResponseCache> cache_;
+  std::chrono::seconds timeout_;
+  mutable SingleFlight<cache::Key, Completion, cache::KeyHasher> flights_;
+};
+
+} // namespace yai::ai
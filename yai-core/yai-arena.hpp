@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "yai-flatmap.hpp"
+
+namespace yai {
+
+// Monotonic arena: allocations are bump-pointer and everything is released
+// at once when the arena goes away. Only trivially destructible objects may
+// live in it.
+class Arena {
+public:
+  explicit Arena(std::size_t initial = 64 * 1024) : resource_{initial} {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  std::pmr::memory_resource *resource() { return &resource_; }
+
+  void *Allocate(std::size_t size, std::size_t align) {
+    return resource_.allocate(size, align);
+  }
+
+  template <class T> T *Allocate(std::size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>);
+    return static_cast<T *>(Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  std::string_view Copy(std::string_view s) {
+    char *data = Allocate<char>(s.size());
+    std::memcpy(data, s.data(), s.size());
+    return {data, s.size()};
+  }
+
+  template <class T> using Vector = std::pmr::vector<T>;
+
+  template <class T> Vector<T> MakeVector() { return Vector<T>{&resource_}; }
+
+private:
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+// Interned strings with dense ids in first-seen order. The text is copied
+// into the arena, so the source buffer may go away.
+class Interner {
+public:
+  explicit Interner(Arena &arena)
+      : arena_{arena}, strings_{arena.MakeVector<std::string_view>()} {}
+
+  std::uint32_t Intern(std::string_view s) {
+    if (const std::uint32_t *id = ids_.Find(s))
+      return *id;
+
+    const std::uint32_t id = static_cast<std::uint32_t>(strings_.size());
+    const std::string_view copy = arena_.Copy(s);
+    strings_.push_back(copy);
+    ids_.Emplace(copy, id);
+
+    return id;
+  }
+
+  std::string_view operator[](std::uint32_t id) const { return strings_[id]; }
+
+  const Arena::Vector<std::string_view> &strings() const { return strings_; }
+
+  std::size_t size() const { return strings_.size(); }
+
+private:
+  Arena &arena_;
+  Arena::Vector<std::string_view> strings_;
+  FlatMap<std::string_view, std::uint32_t> ids_;
+};
+
+} // namespace yai
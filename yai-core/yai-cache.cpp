@@ -0,0 +1,246 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "yai-cache.hpp"
+#include "yai-mmap.hpp"
+
+namespace yai::cache {
+
+namespace {
+
+constexpr std::uint64_t P1 = 0x9e3779b185ebca87ULL;
+constexpr std::uint64_t P2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr std::uint64_t P3 = 0x165667b19e3779f9ULL;
+constexpr std::uint64_t P4 = 0x85ebca77c2b2ae63ULL;
+
+__extension__ typedef unsigned __int128 Wide;
+
+inline std::uint64_t Fold(std::uint64_t a, std::uint64_t b) {
+  const Wide product = static_cast<Wide>(a) * b;
+  return static_cast<std::uint64_t>(product) ^
+         static_cast<std::uint64_t>(product >> 64);
+}
+
+inline std::uint64_t Read64(const unsigned char *p) {
+  std::uint64_t w;
+  std::memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+inline std::uint64_t Avalanche(std::uint64_t h) {
+  h ^= h >> 37;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Header of a cache file; the response follows it.
+struct FileHeader {
+  char magic[8];
+  std::int64_t expires;
+  std::uint64_t lo, hi, size;
+};
+
+constexpr char MAGIC[8] = {'y', 'a', 'i', 'c', 'a', 'c', 'h', '1'};
+
+} // namespace
+
+Key Hash(std::string_view data) {
+  const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+  std::size_t size = data.size();
+  std::uint64_t lo = size * P1, hi = size * P2 ^ P4;
+
+  while (size >= 16) {
+    const std::uint64_t a = Read64(p), b = Read64(p + 8);
+    lo += Fold(a ^ P3 ^ lo, b ^ P1);
+    hi += Fold(b ^ P4 ^ hi, a ^ P2);
+    p += 16;
+    size -= 16;
+  }
+
+  unsigned char tail[16] = {};
+  std::memcpy(tail, p, size);
+  const std::uint64_t a = Read64(tail), b = Read64(tail + 8);
+  lo += Fold(a ^ P3 ^ lo, b ^ P1 ^ size);
+  hi += Fold(b ^ P4 ^ hi, a ^ P2 ^ size);
+
+  return {Avalanche(lo + Fold(hi, P1)), Avalanche(hi + Fold(lo, P2))};
+}
+
+ResponseCache::ResponseCache(std::size_t max_bytes, std::chrono::seconds ttl,
+                             std::string directory)
+    : max_bytes_{max_bytes}, ttl_{ttl}, directory_{std::move(directory)} {
+  if (!directory_.empty())
+    mkdir(directory_.c_str(), 0700);
+}
+
+std::optional<std::string> ResponseCache::Find(const Key &key) {
+  const Clock::time_point now = Clock::now();
+
+  {
+    std::lock_guard lock{mutex_};
+
+    if (Lru::iterator *found = index_.Find(key)) {
+      const Lru::iterator entry = *found;
+
+      if (entry->expires > now) {
+        lru_.splice(lru_.begin(), lru_, entry);
+        ++stats_.memory_hits;
+        return entry->value;
+      }
+
+      Evict(entry);
+    }
+  }
+
+  Clock::time_point expires;
+  std::optional<std::string> value =
+      directory_.empty() ? std::nullopt : Load(key, now, expires);
+
+  std::lock_guard lock{mutex_};
+
+  if (!value) {
+    ++stats_.misses;
+    return std::nullopt;
+  }
+
+  ++stats_.disk_hits;
+  Insert(key, *value, expires);
+
+  return value;
+}
+
+void ResponseCache::Put(const Key &key, std::string_view value) {
+  const Clock::time_point expires = Clock::now() + ttl_;
+
+  {
+    std::lock_guard lock{mutex_};
+    ++stats_.stores;
+    Insert(key, std::string{value}, expires);
+  }
+
+  if (!directory_.empty())
+    Store(key, value, expires);
+}
+
+Stats ResponseCache::stats() const {
+  std::lock_guard lock{mutex_};
+
+  Stats stats = stats_;
+  stats.entries = lru_.size();
+  stats.bytes = bytes_;
+
+  return stats;
+}
+
+void ResponseCache::Insert(const Key &key, std::string value,
+                           Clock::time_point expires) {
+  if (Lru::iterator *found = index_.Find(key))
+    Evict(*found);
+
+  // Too large to keep in memory; the disk tier may still have it.
+  if (value.size() > max_bytes_)
+    return;
+
+  bytes_ += value.size();
+  lru_.push_front({key, std::move(value), expires});
+  index_.Emplace(key, lru_.begin());
+
+  while (bytes_ > max_bytes_) {
+    Evict(std::prev(lru_.end()));
+    ++stats_.evictions;
+  }
+}
+
+void ResponseCache::Evict(Lru::iterator entry) {
+  bytes_ -= entry->value.size();
+  index_.Erase(entry->key);
+  lru_.erase(entry);
+}
+
+std::string ResponseCache::PathOf(const Key &key) const {
+  char name[34];
+  std::snprintf(name, sizeof(name), "/%016llx%016llx",
+                static_cast<unsigned long long>(key.hi),
+                static_cast<unsigned long long>(key.lo));
+  return directory_ + name;
+}
+
+std::optional<std::string>
+ResponseCache::Load(const Key &key, Clock::time_point now,
+                    Clock::time_point &expires) const {
+  const std::string path = PathOf(key);
+  MappedFile file;
+
+  if (file.Open(path.c_str()))
+    return std::nullopt;
+
+  const std::string_view data = file.view();
+  FileHeader header;
+
+  if (data.size() < sizeof(header))
+    return std::nullopt;
+
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.lo != key.lo ||
+      header.hi != key.hi || header.size != data.size() - sizeof(header))
+    return std::nullopt;
+
+  expires = Clock::time_point{std::chrono::seconds{header.expires}};
+
+  if (expires <= now) {
+    unlink(path.c_str());
+    return std::nullopt;
+  }
+
+  return std::string{data.substr(sizeof(header))};
+}
+
+// Written to a temporary file and renamed into place, so that readers in
+// this or other processes never see a partial response.
+void ResponseCache::Store(const Key &key, std::string_view value,
+                          Clock::time_point expires) const {
+  std::string temp = directory_ + "/.tmp-XXXXXX";
+  const int fd = mkstemp(temp.data());
+
+  if (fd < 0)
+    return;
+
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.expires = std::chrono::duration_cast<std::chrono::seconds>(
+                       expires.time_since_epoch())
+                       .count();
+  header.lo = key.lo;
+  header.hi = key.hi;
+  header.size = value.size();
+
+  bool failed = write(fd, &header, sizeof(header)) !=
+                static_cast<ssize_t>(sizeof(header));
+
+  while (!failed && !value.empty()) {
+    const ssize_t n = write(fd, value.data(), value.size());
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    failed = n <= 0;
+    if (!failed)
+      value.remove_prefix(static_cast<std::size_t>(n));
+  }
+
+  close(fd);
+
+  if (failed || rename(temp.c_str(), PathOf(key).c_str()) < 0)
+    unlink(temp.c_str());
+}
+
+} // namespace yai::cache
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "yai-flatmap.hpp"
+
+namespace yai::cache {
+
+// 128-bit content digest; wide enough to stand in for the content itself.
+struct Key {
+  std::uint64_t lo = 0, hi = 0;
+
+  bool operator==(const Key &) const = default;
+};
+
+struct KeyHasher {
+  std::uint64_t operator()(const Key &key) const { return key.lo; }
+};
+
+// Fast non-cryptographic digest of data, folding 16-byte stripes through
+// 64x64->128 bit multiplies in the manner of XXH3.
+Key Hash(std::string_view data);
+
+struct Stats {
+  std::uint64_t memory_hits = 0, disk_hits = 0, misses = 0, stores = 0,
+                evictions = 0;
+  std::size_t entries = 0, bytes = 0;
+};
+
+// Exact-match response cache. Responses live for ttl in an LRU of at most
+// max_bytes and, when there is a directory, in one file per key there,
+// read back through mmap, so that they outlive the process. Disk hits are
+// promoted to memory.
+class ResponseCache {
+public:
+  ResponseCache(std::size_t max_bytes, std::chrono::seconds ttl,
+                std::string directory);
+
+  ResponseCache(const ResponseCache &) = delete;
+  ResponseCache &operator=(const ResponseCache &) = delete;
+
+  std::optional<std::string> Find(const Key &key);
+
+  void Put(const Key &key, std::string_view value);
+
+  Stats stats() const;
+
+  const std::string &directory() const { return directory_; }
+
+private:
+  using Clock = std::chrono::system_clock;
+
+  struct Entry {
+    Key key;
+    std::string value;
+    Clock::time_point expires;
+  };
+
+  using Lru = std::list<Entry>;
+
+  // With mutex_ held.
+  void Insert(const Key &key, std::string value, Clock::time_point expires);
+  void Evict(Lru::iterator entry);
+
+  std::string PathOf(const Key &key) const;
+  std::optional<std::string> Load(const Key &key, Clock::time_point now,
+                                  Clock::time_point &expires) const;
+  void Store(const Key &key, std::string_view value,
+             Clock::time_point expires) const;
+
+  const std::size_t max_bytes_;
+  const std::chrono::seconds ttl_;
+  const std::string directory_;
+
+  mutable std::mutex mutex_;
+  Lru lru_;
+  FlatMap<Key, Lru::iterator, KeyHasher> index_;
+  std::size_t bytes_ = 0;
+  Stats stats_;
+};
+
+} // namespace yai::cache
@@ -0,0 +1,280 @@
+#include <charconv>
+#include <chrono>
+#include <iostream>
+
+#include <poll.h>
+
+#include "yai-dict.hpp"
+#include "yai-pq.hpp"
+
+namespace yai::dict {
+
+std::optional<std::int32_t> Dictionary::Find(std::string_view name) const {
+  std::shared_lock lock{mutex_};
+
+  const std::int32_t *id = ids_.Find(name);
+  if (!id)
+    return std::nullopt;
+
+  return *id;
+}
+
+void Dictionary::Put(std::int32_t id, std::string_view name) {
+  std::unique_lock lock{mutex_};
+
+  if (const std::string *old = names_.Find(id)) {
+    if (*old == name)
+      return;
+    ids_.Erase(*old);
+  }
+
+  names_.Put(id, std::string{name});
+  ids_.Put(name, id);
+  ++version_;
+}
+
+void Dictionary::Erase(std::int32_t id) {
+  std::unique_lock lock{mutex_};
+
+  const std::string *name = names_.Find(id);
+  if (!name)
+    return;
+
+  const std::int32_t *current = ids_.Find(*name);
+  if (current && *current == id)
+    ids_.Erase(*name);
+
+  names_.Erase(id);
+  ++version_;
+}
+
+void Dictionary::Load(PGresult *res) {
+  const int rows = PQntuples(res);
+
+  std::unique_lock lock{mutex_};
+
+  ids_.Clear();
+  names_.Clear();
+  ids_.Reserve(static_cast<std::size_t>(rows));
+  names_.Reserve(static_cast<std::size_t>(rows));
+
+  for (int i = 0; i < rows; ++i) {
+    const std::int32_t id = std::stoi(PQgetvalue(res, i, 0));
+    const std::string_view name{
+        PQgetvalue(res, i, 1),
+        static_cast<std::size_t>(PQgetlength(res, i, 1))};
+    names_.Put(id, std::string{name});
+    ids_.Put(name, id);
+  }
+
+  ++version_;
+}
+
+void Dictionary::Clear() {
+  std::unique_lock lock{mutex_};
+  ids_.Clear();
+  names_.Clear();
+  ++version_;
+}
+
+std::size_t Dictionary::size() const {
+  std::shared_lock lock{mutex_};
+  return names_.size();
+}
+
+Cache &Cache::Instance() {
+  static Cache cache;
+  return cache;
+}
+
+bool Cache::Start(const char *conninfo) {
+  std::lock_guard lock{mutex_};
+
+  if (listener_.joinable())
+    return false;
+
+  conninfo_ = conninfo;
+
+  if (Connect())
+    return true;
+
+  listener_ = std::jthread([this](std::stop_token stop) { Listen(stop); });
+
+  return false;
+}
+
+void Cache::Catchup() {
+  std::lock_guard lock{mutex_};
+
+  if (conn_)
+    Consume();
+}
+
+void Cache::OnChange(std::function<void()> observer) {
+  std::lock_guard lock{mutex_};
+  observers_.push_back(std::move(observer));
+}
+
+void Cache::Notify() {
+  for (const std::function<void()> &observer : observers_)
+    observer();
+}
+
+bool Cache::Connect() {
+  PGconn *conn = PQconnectdb(conninfo_.c_str());
+
+  if (PQstatus(conn) != CONNECTION_OK) {
+    std::cerr << "Dictionary cache: " << PQerrorMessage(conn) << std::endl;
+    PQfinish(conn);
+    return true;
+  }
+
+  // Subscribe before the snapshot so nothing committed in between is lost;
+  // replaying a change the snapshot already has is harmless.
+  PGresult *res = PQexec(conn, "LISTEN yai_booking_dict");
+  const bool listening = PQresultStatus(res) == PGRES_COMMAND_OK;
+  PQclear(res);
+
+  if (!listening) {
+    std::cerr << "Dictionary cache: " << PQerrorMessage(conn) << std::endl;
+    PQfinish(conn);
+    return true;
+  }
+
+  {
+    pq::Pipeline pipeline{conn};
+
+    if (pipeline.Enter()) {
+      std::cerr << "Dictionary cache: " << pipeline.error() << std::endl;
+      PQfinish(conn);
+      return true;
+    }
+
+    const std::size_t consultant_q =
+        pipeline.Push("SELECT id, name FROM yai_booking_consultant");
+    const std::size_t customer_q =
+        pipeline.Push("SELECT id, name FROM yai_booking_customer");
+
+    if (pipeline.Sync()) {
+      std::cerr << "Dictionary cache: " << pipeline.error() << std::endl;
+    } else {
+      consultants_.Load(pipeline.result(consultant_q));
+      customers_.Load(pipeline.result(customer_q));
+      conn_ = conn;
+    }
+  }
+
+  if (!conn_) {
+    PQfinish(conn);
+    return true;
+  }
+
+  ++version_;
+  Notify();
+
+  return false;
+}
+
+void Cache::Consume() {
+  if (!PQconsumeInput(conn_)) {
+    std::cerr << "Dictionary cache: " << PQerrorMessage(conn_) << std::endl;
+    PQfinish(conn_);
+    conn_ = nullptr;
+    return;
+  }
+
+  const std::uint64_t version = version_.load();
+
+  while (PGnotify *notify = PQnotifies(conn_)) {
+    Apply(notify->extra);
+    PQfreemem(notify);
+  }
+
+  if (version != version_.load())
+    Notify();
+}
+
+// Payload is "<table>,<op>,<id>,<name>" as sent by yai_booking_dict_notify().
+void Cache::Apply(std::string_view payload) {
+  const std::size_t table_end = payload.find(',');
+  if (table_end == std::string_view::npos)
+    return;
+
+  const std::string_view table = payload.substr(0, table_end);
+
+  Dictionary *dictionary = nullptr;
+  if (table == "yai_booking_consultant")
+    dictionary = &consultants_;
+  else if (table == "yai_booking_customer")
+    dictionary = &customers_;
+  else
+    return;
+
+  payload.remove_prefix(table_end + 1);
+
+  if (payload == "TRUNCATE") {
+    dictionary->Clear();
+    ++version_;
+    return;
+  }
+
+  const std::size_t op_end = payload.find(',');
+  if (op_end == std::string_view::npos)
+    return;
+
+  const std::string_view op = payload.substr(0, op_end);
+  payload.remove_prefix(op_end + 1);
+
+  std::int32_t id = 0;
+  const auto [id_end, ec] =
+      std::from_chars(payload.data(), payload.data() + payload.size(), id);
+  if (ec != std::errc{} || id_end == payload.data() + payload.size() ||
+      *id_end != ',')
+    return;
+
+  const std::string_view name =
+      payload.substr(static_cast<std::size_t>(id_end - payload.data()) + 1);
+
+  if (op == "DELETE")
+    dictionary->Erase(id);
+  else
+    dictionary->Put(id, name);
+
+  ++version_;
+}
+
+void Cache::Listen(std::stop_token stop) {
+  while (!stop.stop_requested()) {
+    int socket = -1;
+
+    {
+      std::lock_guard lock{mutex_};
+
+      if (conn_ || !Connect())
+        socket = PQsocket(conn_);
+    }
+
+    if (socket < 0) {
+      std::this_thread::sleep_for(std::chrono::seconds{1});
+      continue;
+    }
+
+    pollfd pfd{socket, POLLIN, 0};
+
+    if (poll(&pfd, 1, 250) > 0) {
+      std::lock_guard lock{mutex_};
+
+      if (conn_)
+        Consume();
+    }
+  }
+
+  std::lock_guard lock{mutex_};
+
+  if (conn_) {
+    PQfinish(conn_);
+    conn_ = nullptr;
+  }
+}
+
+} // namespace yai::dict
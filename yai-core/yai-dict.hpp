@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <libpq-fe.h>
+
+#include "yai-flatmap.hpp"
+
+namespace yai::dict {
+
+class Dictionary {
+public:
+  std::optional<std::int32_t> Find(std::string_view name) const;
+
+  void Put(std::int32_t id, std::string_view name);
+
+  void Erase(std::int32_t id);
+
+  void Load(PGresult *res);
+
+  void Clear();
+
+  std::size_t size() const;
+
+  std::uint64_t version() const { return version_.load(); }
+
+  template <class F> void ForEach(F &&f) const {
+    std::shared_lock lock{mutex_};
+    names_.ForEach(f);
+  }
+
+  // Runs f over a consistent view of the id to name map; version() read
+  // inside f matches that view.
+  template <class F> decltype(auto) Read(F &&f) const {
+    std::shared_lock lock{mutex_};
+    return f(names_);
+  }
+
+private:
+  mutable std::shared_mutex mutex_;
+  FlatMap<std::string, std::int32_t> ids_;
+  FlatMap<std::int32_t, std::string> names_;
+  std::atomic<std::uint64_t> version_{0};
+};
+
+// Process-wide consultants and customers by name. It is filled once from the
+// database and then kept current by the yai_booking_dict notification
+// channel, so lookups never run a query.
+class Cache {
+public:
+  static Cache &Instance();
+
+  bool Start(const char *conninfo);
+
+  // Applies the notifications already delivered to the listener socket.
+  void Catchup();
+
+  // Called after every batch of applied changes, on the thread applying
+  // them; it must not call back into Start or Catchup.
+  void OnChange(std::function<void()> observer);
+
+  std::uint64_t version() const { return version_.load(); }
+
+  const Dictionary &consultants() const { return consultants_; }
+  const Dictionary &customers() const { return customers_; }
+
+  Dictionary &consultants() { return consultants_; }
+  Dictionary &customers() { return customers_; }
+
+private:
+  Cache() = default;
+
+  bool Connect();
+  void Consume();
+  void Apply(std::string_view payload);
+  void Notify();
+  void Listen(std::stop_token stop);
+
+  Dictionary consultants_, customers_;
+  std::atomic<std::uint64_t> version_{0};
+
+  std::mutex mutex_;
+  std::string conninfo_;
+  PGconn *conn_ = nullptr;
+  std::vector<std::function<void()>> observers_;
+  std::jthread listener_;
+};
+
+} // namespace yai::dict
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace yai {
+
+inline static std::uint64_t HashBytes(const void *data, std::size_t size) {
+  static constexpr std::uint64_t MUL = 0x9e3779b97f4a7c15ULL;
+
+  const auto *p = static_cast<const unsigned char *>(data);
+  std::uint64_t h = (size + 1) * MUL;
+
+  while (size >= sizeof(std::uint64_t)) {
+    std::uint64_t w;
+    std::memcpy(&w, p, sizeof(w));
+    h = (h ^ w) * MUL;
+    h ^= h >> 32;
+    p += sizeof(w);
+    size -= sizeof(w);
+  }
+
+  std::uint64_t w = 0;
+  std::memcpy(&w, p, size);
+  h = (h ^ w) * MUL;
+  h ^= h >> 29;
+
+  return h;
+}
+
+struct Hasher {
+  std::uint64_t operator()(std::string_view s) const {
+    return HashBytes(s.data(), s.size());
+  }
+
+  template <class T>
+    requires std::is_integral_v<T>
+  std::uint64_t operator()(T n) const {
+    return HashBytes(&n, sizeof(n));
+  }
+};
+
+// Open-addressing map with linear probing. Slot hashes 0 and 1 are
+// reserved for empty and erased slots.
+template <class K, class V, class H = Hasher> class FlatMap {
+public:
+  explicit FlatMap(std::size_t reserve = 16) { Reserve(reserve); }
+
+  template <class Q> V *Find(const Q &key) {
+    const std::size_t index = Probe(key, Hash(key));
+    return slots_[index].hash > ERASED ? &slots_[index].value : nullptr;
+  }
+
+  template <class Q> const V *Find(const Q &key) const {
+    return const_cast<FlatMap *>(this)->Find(key);
+  }
+
+  template <class Q> bool Contains(const Q &key) const {
+    return Find(key) != nullptr;
+  }
+
+  // Returns the mapped value and whether the key was newly inserted.
+  template <class Q> std::pair<V *, bool> Emplace(const Q &key, V value) {
+    if ((size_ + erased_ + 1) * 8 > slots_.size() * 7)
+      Rehash(size_ * 2 > slots_.size() / 2 ? slots_.size() * 2
+                                           : slots_.size());
+
+    const std::uint64_t hash = Hash(key);
+    const std::size_t index = Probe(key, hash);
+    Slot &slot = slots_[index];
+
+    if (slot.hash > ERASED)
+      return {&slot.value, false};
+
+    if (slot.hash == ERASED)
+      --erased_;
+
+    slot.hash = hash;
+    slot.key = K(key);
+    slot.value = std::move(value);
+    ++size_;
+
+    return {&slot.value, true};
+  }
+
+  template <class Q> V &Put(const Q &key, V value) {
+    auto [slot, inserted] = Emplace(key, value);
+    if (!inserted)
+      *slot = std::move(value);
+    return *slot;
+  }
+
+  template <class Q> bool Erase(const Q &key) {
+    Slot &slot = slots_[Probe(key, Hash(key))];
+
+    if (slot.hash <= ERASED)
+      return false;
+
+    slot.hash = ERASED;
+    slot.key = K{};
+    slot.value = V{};
+    --size_;
+    ++erased_;
+
+    return true;
+  }
+
+  template <class F> void ForEach(F &&f) const {
+    for (const Slot &slot : slots_)
+      if (slot.hash > ERASED)
+        f(slot.key, slot.value);
+  }
+
+  void Reserve(std::size_t n) {
+    std::size_t capacity = 16;
+    while (capacity * 7 < n * 8)
+      capacity *= 2;
+    if (capacity > slots_.size())
+      Rehash(capacity);
+  }
+
+  void Clear() {
+    slots_.assign(slots_.size(), Slot{});
+    size_ = 0;
+    erased_ = 0;
+  }
+
+  std::size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+private:
+  static constexpr std::uint64_t EMPTY = 0, ERASED = 1;
+
+  struct Slot {
+    std::uint64_t hash = EMPTY;
+    K key{};
+    V value{};
+  };
+
+  template <class Q> std::uint64_t Hash(const Q &key) const {
+    const std::uint64_t hash = H{}(key);
+    return hash > ERASED ? hash : hash + 2;
+  }
+
+  // Index of the slot holding key, or of the slot where it would be placed.
+  template <class Q> std::size_t Probe(const Q &key, std::uint64_t hash) const {
+    const std::size_t mask = slots_.size() - 1;
+    std::size_t index = static_cast<std::size_t>(hash) & mask;
+    std::size_t reuse = slots_.size();
+
+    for (;;) {
+      const Slot &slot = slots_[index];
+
+      if (slot.hash == EMPTY)
+        return reuse != slots_.size() ? reuse : index;
+
+      if (slot.hash == ERASED) {
+        if (reuse == slots_.size())
+          reuse = index;
+      } else if (slot.hash == hash && slot.key == key) {
+        return index;
+      }
+
+      index = (index + 1) & mask;
+    }
+  }
+
+  void Rehash(std::size_t capacity) {
+    std::vector<Slot> slots(capacity);
+    slots.swap(slots_);
+    size_ = 0;
+    erased_ = 0;
+
+    for (Slot &slot : slots) {
+      if (slot.hash > ERASED) {
+        Slot &target = slots_[Probe(slot.key, slot.hash)];
+        target = std::move(slot);
+        ++size_;
+      }
+    }
+  }
+
+  std::vector<Slot> slots_;
+  std::size_t size_ = 0, erased_ = 0;
+};
+
+template <class K, class H = Hasher> class FlatSet {
+public:
+  explicit FlatSet(std::size_t reserve = 16) : map_{reserve} {}
+
+  // Returns whether the key was not already present.
+  template <class Q> bool Insert(const Q &key) {
+    return map_.Emplace(key, Unit{}).second;
+  }
+
+  template <class Q> bool Contains(const Q &key) const {
+    return map_.Contains(key);
+  }
+
+  template <class Q> bool Erase(const Q &key) { return map_.Erase(key); }
+
+  void Reserve(std::size_t n) { map_.Reserve(n); }
+
+  std::size_t size() const { return map_.size(); }
+
+private:
+  struct Unit {};
+
+  FlatMap<K, Unit, H> map_;
+};
+
+} // namespace yai
@@ -0,0 +1,123 @@
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "yai-mmap.hpp"
+
+namespace yai {
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(data_, size_);
+}
+
+bool MappedFile::Open(const char *path) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    error_ = std::strerror(errno);
+    return true;
+  }
+
+  const bool failed = Open(fd);
+  close(fd);
+
+  return failed;
+}
+
+bool MappedFile::Open(int fd) {
+  struct stat st;
+
+  if (fstat(fd, &st) < 0) {
+    error_ = std::strerror(errno);
+    return true;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    error_ = "Not a regular file";
+    return true;
+  }
+
+  // An empty file cannot be mapped; it is an empty view instead.
+  if (st.st_size == 0)
+    return false;
+
+  const std::size_t size = static_cast<std::size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (data == MAP_FAILED) {
+    error_ = std::strerror(errno);
+    return true;
+  }
+
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  if (data_)
+    munmap(data_, size_);
+
+  data_ = data;
+  size_ = size;
+
+  return false;
+}
+
+bool WatchedFile::Load() {
+  std::lock_guard lock{mutex_};
+  next_check_ = (std::chrono::steady_clock::now() + interval_)
+                    .time_since_epoch()
+                    .count();
+  return Refresh();
+}
+
+std::shared_ptr<const std::string> WatchedFile::Get() {
+  const auto now = std::chrono::steady_clock::now();
+
+  if (now.time_since_epoch().count() >= next_check_.load()) {
+    // Whoever holds the lock is already looking at the file.
+    std::unique_lock lock{mutex_, std::try_to_lock};
+
+    if (lock.owns_lock()) {
+      next_check_ = (now + interval_).time_since_epoch().count();
+      Refresh();
+    }
+  }
+
+  return contents_.load();
+}
+
+bool WatchedFile::Refresh() {
+  struct stat st;
+
+  if (stat(path_.c_str(), &st) < 0) {
+    error_ = std::strerror(errno);
+    return true;
+  }
+
+  if (contents_.load() && st.st_dev == dev_ && st.st_ino == ino_ &&
+      st.st_size == size_ && st.st_mtim.tv_sec == mtime_.tv_sec &&
+      st.st_mtim.tv_nsec == mtime_.tv_nsec)
+    return false;
+
+  MappedFile file;
+
+  if (file.Open(path_.c_str())) {
+    error_ = file.error();
+    return true;
+  }
+
+  contents_ = std::make_shared<const std::string>(file.view());
+
+  dev_ = st.st_dev;
+  ino_ = st.st_ino;
+  size_ = st.st_size;
+  mtime_ = st.st_mtim;
+  error_.clear();
+
+  return false;
+}
+
+} // namespace yai
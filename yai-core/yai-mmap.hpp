@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/types.h>
+
+namespace yai {
+
+// Read-only private mapping of a whole file, advised for a single sequential
+// pass. The view stays valid until the object goes away.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool Open(const char *path);
+
+  // The descriptor is not taken over; it may be closed once this returns.
+  bool Open(int fd);
+
+  std::string_view view() const {
+    return {static_cast<const char *>(data_), size_};
+  }
+
+  const char *error() const { return error_.c_str(); }
+
+private:
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+  std::string error_;
+};
+
+// Contents of a small file kept in memory and reloaded when it changes.
+// The file is looked at again at most once per interval; readers get
+// immutable snapshots, so a reload never changes text already handed out.
+// A file that goes away keeps its last contents.
+class WatchedFile {
+public:
+  explicit WatchedFile(std::string path, std::chrono::milliseconds interval =
+                                             std::chrono::seconds{1})
+      : path_{std::move(path)}, interval_{interval} {}
+
+  WatchedFile(const WatchedFile &) = delete;
+  WatchedFile &operator=(const WatchedFile &) = delete;
+
+  // Initial load, reporting why the file cannot be read.
+  bool Load();
+
+  // Null while the file has never been read.
+  std::shared_ptr<const std::string> Get();
+
+  const std::string &path() const { return path_; }
+
+  const char *error() const { return error_.c_str(); }
+
+private:
+  bool Refresh();
+
+  const std::string path_;
+  const std::chrono::steady_clock::duration interval_;
+
+  std::atomic<std::shared_ptr<const std::string>> contents_;
+  std::atomic<std::chrono::steady_clock::rep> next_check_{0};
+
+  // Held while looking at the file; guards the fields below.
+  std::mutex mutex_;
+  dev_t dev_ = 0;
+  ino_t ino_ = 0;
+  off_t size_ = 0;
+  struct timespec mtime_ {};
+  std::string error_;
+};
+
+} // namespace yai
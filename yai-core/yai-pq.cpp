@@ -0,0 +1,270 @@
+#include <limits>
+#include <type_traits>
+
+#include <poll.h>
+
+#include "yai-pq.hpp"
+
+namespace yai::pq {
+
+Pipeline::Pipeline(PGconn *conn) : conn_{conn}, queued_{0} {}
+
+Pipeline::~Pipeline() {
+  for (PGresult *res : results_)
+    PQclear(res);
+
+  if (queued_)
+    Discard();
+
+  if (PQpipelineStatus(conn_) != PQ_PIPELINE_OFF) {
+    PQexitPipelineMode(conn_);
+    PQsetnonblocking(conn_, 0);
+  }
+}
+
+bool Pipeline::Enter() {
+  if (!PQenterPipelineMode(conn_) || PQsetnonblocking(conn_, 1)) {
+    error_ = PQerrorMessage(conn_);
+    return true;
+  }
+
+  return false;
+}
+
+std::size_t Pipeline::Push(const char *query) {
+  return Push(query, 0, nullptr);
+}
+
+// Nothing is queued once a send failed; Sync then reports the error.
+std::size_t Pipeline::Push(const char *query, int nparams,
+                           const char *const *values) {
+  if (!error_.empty())
+    return results_.size();
+
+  if (!PQsendQueryParams(conn_, query, nparams, nullptr, values, nullptr,
+                         nullptr, 0)) {
+    error_ = PQerrorMessage(conn_);
+    return results_.size();
+  }
+
+  results_.push_back(nullptr);
+  ++queued_;
+
+  return results_.size() - 1;
+}
+
+bool Pipeline::Flush() {
+  pollfd pfd{PQsocket(conn_), POLLIN | POLLOUT, 0};
+
+  for (;;) {
+    const int pending = PQflush(conn_);
+
+    if (pending == 0)
+      return false;
+
+    if (pending < 0 || poll(&pfd, 1, -1) < 0) {
+      error_ = PQerrorMessage(conn_);
+      return true;
+    }
+
+    // Drain whatever the server already answered so it never blocks on a
+    // full send buffer while we are still writing the rest of the batch.
+    if ((pfd.revents & POLLIN) && !PQconsumeInput(conn_)) {
+      error_ = PQerrorMessage(conn_);
+      return true;
+    }
+  }
+}
+
+// Drops the results of the queries sent so far, through the sync that ends
+// them, so that the connection may leave pipeline mode.
+void Pipeline::Discard() {
+  queued_ = 0;
+
+  if (!PQpipelineSync(conn_) || Flush())
+    return;
+
+  for (;;) {
+    PGresult *res = PQgetResult(conn_);
+
+    if (!res) {
+      if (PQstatus(conn_) != CONNECTION_OK)
+        return;
+      continue;
+    }
+
+    const bool sync = PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+    PQclear(res);
+
+    if (sync)
+      return;
+  }
+}
+
+bool Pipeline::Sync() {
+  if (!error_.empty()) {
+    Discard();
+    return true;
+  }
+
+  if (!PQpipelineSync(conn_) || Flush()) {
+    queued_ = 0;
+    return true;
+  }
+
+  bool failed = false;
+
+  for (std::size_t i = results_.size() - queued_; i < results_.size(); ++i) {
+    PGresult *res = PQgetResult(conn_);
+
+    if (!res) {
+      error_ = PQerrorMessage(conn_);
+      queued_ = 0;
+      return true;
+    }
+
+    const ExecStatusType status = PQresultStatus(res);
+
+    if (!failed &&
+        (status == PGRES_FATAL_ERROR || status == PGRES_PIPELINE_ABORTED)) {
+      error_ = PQresultErrorMessage(res);
+      failed = true;
+    }
+
+    results_[i] = res;
+
+    while ((res = PQgetResult(conn_)))
+      PQclear(res);
+  }
+
+  queued_ = 0;
+
+  PGresult *sync = PQgetResult(conn_);
+  if (PQresultStatus(sync) != PGRES_PIPELINE_SYNC && !failed) {
+    error_ = PQerrorMessage(conn_);
+    failed = true;
+  }
+  PQclear(sync);
+
+  return failed;
+}
+
+namespace {
+
+static constexpr std::size_t COPY_CHUNK = 256 * 1024;
+
+static constexpr char COPY_SIGNATURE[] = "PGCOPY\n\377\r\n";
+
+} // namespace
+
+BinaryCopy::BinaryCopy(PGconn *conn) : conn_{conn} {
+  buffer_.reserve(COPY_CHUNK + 4096);
+}
+
+bool BinaryCopy::Begin(const char *copy_q) {
+  PGresult *res = PQexec(conn_, copy_q);
+  const bool failed = PQresultStatus(res) != PGRES_COPY_IN;
+
+  if (failed)
+    error_ = PQresultErrorMessage(res);
+
+  PQclear(res);
+
+  if (failed)
+    return true;
+
+  // Signature (with its NUL), flags and header extension length.
+  buffer_.append(COPY_SIGNATURE, sizeof(COPY_SIGNATURE));
+  Put<std::int32_t>(0);
+  Put<std::int32_t>(0);
+
+  return false;
+}
+
+template <class T> void BinaryCopy::Put(T value) {
+  using U = std::make_unsigned_t<T>;
+  const U u = static_cast<U>(value);
+
+  for (std::size_t shift = sizeof(T) * 8; shift > 0; shift -= 8)
+    buffer_.push_back(static_cast<char>((u >> (shift - 8)) & 0xFF));
+}
+
+bool BinaryCopy::Row(std::int16_t fields) {
+  if ((buffer_.size() >= COPY_CHUNK && Flush()) || !error_.empty())
+    return true;
+
+  Put(fields);
+
+  return false;
+}
+
+void BinaryCopy::Int4(std::int32_t value) {
+  if (!error_.empty())
+    return;
+
+  Put<std::int32_t>(sizeof(value));
+  Put(value);
+}
+
+void BinaryCopy::Int8(std::int64_t value) {
+  if (!error_.empty())
+    return;
+
+  Put<std::int32_t>(sizeof(value));
+  Put(value);
+}
+
+void BinaryCopy::Text(std::string_view value) {
+  if (!error_.empty())
+    return;
+
+  if (value.size() >
+      static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max())) {
+    error_ = "Text value too long for COPY";
+    buffer_.clear();
+    return;
+  }
+
+  Put(static_cast<std::int32_t>(value.size()));
+  buffer_.append(value);
+}
+
+bool BinaryCopy::Flush() {
+  if (buffer_.empty() || !error_.empty())
+    return !error_.empty();
+
+  if (PQputCopyData(conn_, buffer_.data(),
+                    static_cast<int>(buffer_.size())) != 1) {
+    error_ = PQerrorMessage(conn_);
+    buffer_.clear();
+    return true;
+  }
+
+  buffer_.clear();
+
+  return false;
+}
+
+bool BinaryCopy::End() {
+  Put<std::int16_t>(-1);
+
+  if (Flush()) {
+    PQputCopyEnd(conn_, error_.c_str());
+  } else if (PQputCopyEnd(conn_, nullptr) != 1) {
+    error_ = PQerrorMessage(conn_);
+  }
+
+  bool failed = !error_.empty();
+
+  while (PGresult *res = PQgetResult(conn_)) {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK && !failed) {
+      error_ = PQresultErrorMessage(res);
+      failed = true;
+    }
+    PQclear(res);
+  }
+
+  return failed;
+}
+
+} // namespace yai::pq
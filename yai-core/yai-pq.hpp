@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libpq-fe.h>
+
+namespace yai::pq {
+
+class Pipeline {
+public:
+  explicit Pipeline(PGconn *conn);
+  ~Pipeline();
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  bool Enter();
+
+  // Returns the index of the query's result, valid once Sync succeeded.
+  std::size_t Push(const char *query);
+
+  std::size_t Push(const char *query, int nparams, const char *const *values);
+
+  bool Sync();
+
+  PGresult *result(std::size_t index) const { return results_[index]; }
+
+  const char *error() const { return error_.c_str(); }
+
+private:
+  bool Flush();
+
+  void Discard();
+
+  PGconn *conn_;
+  std::vector<PGresult *> results_;
+  std::size_t queued_;
+  std::string error_;
+};
+
+// Streams rows through COPY ... FROM STDIN (FORMAT binary). Values are
+// appended field by field after Row() and sent in large chunks. After an
+// error nothing more is appended and End() reports it.
+class BinaryCopy {
+public:
+  explicit BinaryCopy(PGconn *conn);
+
+  bool Begin(const char *copy_q);
+
+  // Returns true once an error stopped the copy.
+  bool Row(std::int16_t fields);
+
+  void Int4(std::int32_t value);
+
+  void Int8(std::int64_t value);
+
+  void Timestamp(std::int64_t usecs) { Int8(usecs); }
+
+  // Values over INT32_MAX bytes fail the copy.
+  void Text(std::string_view value);
+
+  bool End();
+
+  const char *error() const { return error_.c_str(); }
+
+private:
+  template <class T> void Put(T value);
+
+  bool Flush();
+
+  PGconn *conn_;
+  std::string buffer_;
+  std::string error_;
+};
+
+} // namespace yai::pq
@@ -0,0 +1,188 @@
+#include <algorithm>
+
+#include "yai-ai.hpp"
+#include "yai-scheduler.hpp"
+
+namespace yai::ai {
+
+// A new limit starts with a full bucket.
+void Scheduler::Bucket::Configure(std::size_t limit, Clock::time_point now) {
+  Refill(now);
+
+  if (limit != per_minute)
+    level = static_cast<double>(limit);
+
+  per_minute = limit;
+  rate = static_cast<double>(limit) / 60;
+  capacity = static_cast<double>(limit);
+}
+
+void Scheduler::Bucket::Refill(Clock::time_point now) {
+  const std::chrono::duration<double> elapsed = now - updated;
+  level = std::min(capacity, level + elapsed.count() * rate);
+  updated = now;
+}
+
+Scheduler::Clock::duration Scheduler::Bucket::Wait(double amount) const {
+  if (!per_minute || level >= std::min(amount, capacity))
+    return Clock::duration::zero();
+
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>{(std::min(amount, capacity) - level) /
+                                    rate});
+}
+
+// Unlimited buckets keep no level. The level may go below zero when a call
+// is charged after the fact; later calls then wait for it to refill.
+void Scheduler::Bucket::Take(double amount) {
+  if (per_minute)
+    level -= amount;
+}
+
+Scheduler::Ticket::~Ticket() {
+  if (scheduler_)
+    scheduler_->Release();
+}
+
+void Scheduler::Ticket::Charge(std::size_t tokens) {
+  if (!scheduler_)
+    return;
+
+  std::lock_guard lock{scheduler_->mutex_};
+  scheduler_->tokens_.Refill(Clock::now());
+  scheduler_->tokens_.Take(static_cast<double>(tokens));
+}
+
+Scheduler &Scheduler::Instance() {
+  // Never destroyed: calls may still be in flight at exit.
+  static Scheduler *scheduler = new Scheduler;
+  return *scheduler;
+}
+
+void Scheduler::Configure(const Limits &limits) {
+  const Clock::time_point now = Clock::now();
+
+  {
+    std::lock_guard lock{mutex_};
+
+    limits_ = limits;
+    limits_.concurrency = std::max<std::size_t>(limits_.concurrency, 1);
+    requests_.Configure(limits.requests_per_minute, now);
+    tokens_.Configure(limits.tokens_per_minute, now);
+  }
+
+  changed_.notify_all();
+}
+
+Scheduler::Ticket Scheduler::Acquire(Priority priority, std::size_t tokens,
+                                     const CancelToken *cancel) {
+  const std::size_t c = static_cast<std::size_t>(priority);
+  const Clock::time_point enqueued = Clock::now();
+  const double amount = static_cast<double>(tokens);
+
+  std::unique_lock lock{mutex_};
+  const std::uint64_t ticket = next_[c]++;
+
+  for (;;) {
+    if (cancel && cancel->cancelled()) {
+      if (ticket == serving_[c])
+        Advance(c);
+      else
+        abandoned_[c].push_back(ticket);
+
+      lock.unlock();
+      changed_.notify_all();
+
+      return Ticket{nullptr};
+    }
+
+    const bool turn =
+        ticket == serving_[c] &&
+        (priority == Priority::INTERACTIVE ||
+         next_[static_cast<std::size_t>(Priority::INTERACTIVE)] ==
+             serving_[static_cast<std::size_t>(Priority::INTERACTIVE)]) &&
+        running_ < limits_.concurrency;
+
+    if (!turn) {
+      changed_.wait(lock);
+      continue;
+    }
+
+    const Clock::time_point now = Clock::now();
+    requests_.Refill(now);
+    tokens_.Refill(now);
+
+    const Clock::duration wait =
+        std::max(requests_.Wait(1), tokens_.Wait(amount));
+
+    if (wait == Clock::duration::zero())
+      break;
+
+    changed_.wait_for(lock, wait);
+  }
+
+  requests_.Take(1);
+  tokens_.Take(amount);
+  ++running_;
+  Advance(c);
+
+  SchedulerStats::Class &stats =
+      priority == Priority::INTERACTIVE ? stats_.interactive : stats_.batch;
+  const auto queued = std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - enqueued);
+
+  ++stats.admitted;
+  stats.queue_time += queued;
+  stats.max_queue_time = std::max(stats.max_queue_time, queued);
+
+  lock.unlock();
+  changed_.notify_all();
+
+  return Ticket{this};
+}
+
+SchedulerStats Scheduler::stats() const {
+  std::lock_guard lock{mutex_};
+
+  SchedulerStats stats = stats_;
+  stats.interactive.waiting =
+      static_cast<std::size_t>(next_[0] - serving_[0]) - abandoned_[0].size();
+  stats.batch.waiting =
+      static_cast<std::size_t>(next_[1] - serving_[1]) - abandoned_[1].size();
+  stats.running = running_;
+
+  return stats;
+}
+
+// Taking the lock orders the wake-up after a waiter's look at its token.
+void Scheduler::Interrupt() {
+  {
+    std::lock_guard lock{mutex_};
+  }
+
+  changed_.notify_all();
+}
+
+void Scheduler::Advance(std::size_t c) {
+  std::vector<std::uint64_t> &abandoned = abandoned_[c];
+
+  for (++serving_[c];; ++serving_[c]) {
+    const auto it = std::find(abandoned.begin(), abandoned.end(), serving_[c]);
+    if (it == abandoned.end())
+      break;
+
+    *it = abandoned.back();
+    abandoned.pop_back();
+  }
+}
+
+void Scheduler::Release() {
+  {
+    std::lock_guard lock{mutex_};
+    --running_;
+  }
+
+  changed_.notify_all();
+}
+
+} // namespace yai::ai
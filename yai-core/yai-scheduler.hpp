@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace yai::ai {
+
+class CancelToken;
+
+// Interactive calls are admitted ahead of any waiting batch call.
+enum class Priority : std::uint8_t { INTERACTIVE, BATCH };
+
+// Zero rates are unlimited. Each bucket holds up to one minute's worth.
+struct Limits {
+  std::size_t requests_per_minute = 0, tokens_per_minute = 0;
+  std::size_t concurrency = 16;
+};
+
+struct SchedulerStats {
+  struct Class {
+    std::uint64_t admitted = 0;
+    std::size_t waiting = 0;
+    std::chrono::microseconds queue_time{0}, max_queue_time{0};
+  };
+
+  Class interactive, batch;
+  std::size_t running = 0;
+};
+
+// Process-wide admission control for upstream model calls: token buckets
+// for requests and tokens, a bound on calls in flight, and strict priority
+// between classes, first come first served within one.
+class Scheduler {
+public:
+  // Holds a concurrency slot until destroyed. Empty when the call was
+  // cancelled while waiting.
+  class Ticket {
+  public:
+    Ticket(Ticket &&other) noexcept : scheduler_{other.scheduler_} {
+      other.scheduler_ = nullptr;
+    }
+
+    Ticket(const Ticket &) = delete;
+    Ticket &operator=(const Ticket &) = delete;
+    Ticket &operator=(Ticket &&) = delete;
+
+    ~Ticket();
+
+    explicit operator bool() const { return scheduler_ != nullptr; }
+
+    // Takes tokens known only once the call is done, such as the answer's,
+    // from the token bucket.
+    void Charge(std::size_t tokens);
+
+  private:
+    friend class Scheduler;
+
+    explicit Ticket(Scheduler *scheduler) : scheduler_{scheduler} {}
+
+    Scheduler *scheduler_;
+  };
+
+  static Scheduler &Instance();
+
+  void Configure(const Limits &limits);
+
+  // Blocks until a call of about tokens prompt tokens may go out, or until
+  // cancel is cancelled, which leaves the queue and returns an empty ticket.
+  Ticket Acquire(Priority priority, std::size_t tokens,
+                 const CancelToken *cancel = nullptr);
+
+  // Wakes the waiting calls to look at their cancel tokens.
+  void Interrupt();
+
+  SchedulerStats stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Bucket {
+    std::size_t per_minute = 0;
+    double level = 0, rate = 0, capacity = 0;
+    Clock::time_point updated;
+
+    void Configure(std::size_t limit, Clock::time_point now);
+    void Refill(Clock::time_point now);
+    Clock::duration Wait(double amount) const;
+    void Take(double amount);
+  };
+
+  Scheduler() = default;
+
+  void Release();
+
+  // Moves class c on to its next ticket still waiting.
+  void Advance(std::size_t c);
+
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  Limits limits_;
+  Bucket requests_, tokens_;
+  std::size_t running_ = 0;
+
+  // Per class: tickets handed out, the one at the head of the queue and
+  // those behind it whose calls were cancelled.
+  std::uint64_t next_[2] = {0, 0}, serving_[2] = {0, 0};
+  std::vector<std::uint64_t> abandoned_[2];
+  SchedulerStats stats_;
+};
+
+} // namespace yai::ai
@@ -0,0 +1,114 @@
+#include <vector>
+
+#include "yai-session.hpp"
+
+namespace yai::session {
+
+std::size_t EstimateTokens(std::string_view text) {
+  static constexpr std::size_t MESSAGE_OVERHEAD = 4;
+
+  std::size_t tokens = MESSAGE_OVERHEAD, word = 0;
+
+  for (const char ch : text) {
+    const unsigned char c = static_cast<unsigned char>(ch);
+    const unsigned char lower = static_cast<unsigned char>(c | 0x20);
+
+    if (c >= 0x80 || (c >= '0' && c <= '9') ||
+        (lower >= 'a' && lower <= 'z')) {
+      ++word;
+      continue;
+    }
+
+    tokens += (word + 3) / 4;
+    word = 0;
+
+    if (c != ' ')
+      ++tokens;
+  }
+
+  return tokens + (word + 3) / 4;
+}
+
+void Session::Append(std::string_view question, std::string_view answer,
+                     std::size_t budget) {
+  std::lock_guard lock{mutex_};
+
+  const std::size_t tokens = EstimateTokens(question) + EstimateTokens(answer);
+  turns_.push_back({arena_->Copy(question), arena_->Copy(answer), tokens});
+  tokens_ += tokens;
+  live_bytes_ += question.size() + answer.size();
+  arena_bytes_ += question.size() + answer.size();
+
+  while (tokens_ > budget && turns_.size() > 1) {
+    const Turn &turn = turns_.front();
+    tokens_ -= turn.tokens;
+    live_bytes_ -= turn.question.size() + turn.answer.size();
+    turns_.pop_front();
+  }
+
+  if (arena_bytes_ > 2 * live_bytes_ + INITIAL_ARENA)
+    Compact();
+}
+
+void Session::Clear() {
+  std::lock_guard lock{mutex_};
+
+  turns_.clear();
+  arena_ = std::make_unique<Arena>(INITIAL_ARENA);
+  tokens_ = live_bytes_ = arena_bytes_ = 0;
+}
+
+// Copies the live turns into a fresh arena and frees the trimmed ones.
+void Session::Compact() {
+  auto arena = std::make_unique<Arena>(live_bytes_ + INITIAL_ARENA);
+
+  for (Turn &turn : turns_) {
+    turn.question = arena->Copy(turn.question);
+    turn.answer = arena->Copy(turn.answer);
+  }
+
+  arena_ = std::move(arena);
+  arena_bytes_ = live_bytes_;
+}
+
+Store &Store::Instance() {
+  static Store store;
+  return store;
+}
+
+std::shared_ptr<Session> Store::Get(std::string_view id,
+                                    std::chrono::seconds idle) {
+  const Clock::time_point now = Clock::now();
+  std::lock_guard lock{mutex_};
+
+  if (now - swept_ > idle / 16)
+    Sweep(now, idle);
+
+  Entry &entry = *sessions_.Emplace(id, {}).first;
+  if (!entry.session)
+    entry.session = std::make_shared<Session>();
+  entry.used = now;
+
+  return entry.session;
+}
+
+void Store::Erase(std::string_view id) {
+  std::lock_guard lock{mutex_};
+  sessions_.Erase(id);
+}
+
+void Store::Sweep(Clock::time_point now, std::chrono::seconds idle) {
+  std::vector<std::string> stale;
+
+  sessions_.ForEach([&](const std::string &id, const Entry &entry) {
+    if (now - entry.used > idle)
+      stale.push_back(id);
+  });
+
+  for (const std::string &id : stale)
+    sessions_.Erase(id);
+
+  swept_ = now;
+}
+
+} // namespace yai::session
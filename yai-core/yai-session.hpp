@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "yai-arena.hpp"
+#include "yai-flatmap.hpp"
+
+namespace yai::session {
+
+// Rough token count of a chat message, good enough for budgeting: a token
+// per four word bytes and one per other non-blank character, plus the
+// per-message overhead.
+std::size_t EstimateTokens(std::string_view text);
+
+// The chat history of one conversation, kept in an arena that is compacted
+// as old turns are trimmed away.
+class Session {
+public:
+  Session() : arena_{std::make_unique<Arena>(INITIAL_ARENA)} {}
+
+  // Calls f(question, answer), oldest first, for the newest turns that fit
+  // in budget tokens.
+  template <class F> void ForEach(std::size_t budget, F &&f) const {
+    std::lock_guard lock{mutex_};
+
+    std::size_t first = turns_.size(), tokens = 0;
+    while (first > 0 && tokens + turns_[first - 1].tokens <= budget)
+      tokens += turns_[--first].tokens;
+
+    for (std::size_t i = first; i < turns_.size(); ++i)
+      f(turns_[i].question, turns_[i].answer);
+  }
+
+  // Adds a turn and drops the oldest ones beyond budget tokens.
+  void Append(std::string_view question, std::string_view answer,
+              std::size_t budget);
+
+  void Clear();
+
+private:
+  static constexpr std::size_t INITIAL_ARENA = 16 * 1024;
+
+  struct Turn {
+    std::string_view question, answer;
+    std::size_t tokens;
+  };
+
+  void Compact();
+
+  mutable std::mutex mutex_;
+  std::unique_ptr<Arena> arena_;
+  std::deque<Turn> turns_;
+  std::size_t tokens_ = 0, live_bytes_ = 0, arena_bytes_ = 0;
+};
+
+// Process-wide sessions by id. Sessions idle for longer than the idle time
+// given to Get are dropped.
+class Store {
+public:
+  static Store &Instance();
+
+  // The session for id, created when missing.
+  std::shared_ptr<Session> Get(std::string_view id,
+                               std::chrono::seconds idle);
+
+  void Erase(std::string_view id);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<Session> session;
+    Clock::time_point used;
+  };
+
+  void Sweep(Clock::time_point now, std::chrono::seconds idle);
+
+  std::mutex mutex_;
+  FlatMap<std::string, Entry> sessions_;
+  Clock::time_point swept_;
+};
+
+} // namespace yai::session
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "yai-flatmap.hpp"
+
+namespace yai {
+
+// Collapses concurrent calls with equal keys into one: the first caller
+// runs the operation and every caller that arrives while it is in flight
+// waits for it and gets the same result. Nothing is kept once the call
+// completes; caching is left to the callers.
+template <class K, class V, class H = Hasher> class SingleFlight {
+public:
+  // Runs f(), returning a V, unless a call for key is already running.
+  template <class Q, class F>
+  std::shared_ptr<const V> Do(const Q &key, F &&f) {
+    std::shared_ptr<Call> call;
+    bool leader;
+
+    {
+      std::lock_guard lock{mutex_};
+      auto [slot, inserted] = calls_.Emplace(key, nullptr);
+      if (inserted)
+        *slot = std::make_shared<Call>();
+      call = *slot;
+      leader = inserted;
+    }
+
+    if (!leader) {
+      std::unique_lock lock{call->mutex};
+      call->done.wait(lock, [&] { return call->result != nullptr; });
+      return call->result;
+    }
+
+    auto result = std::make_shared<const V>(std::forward<F>(f)());
+
+    {
+      std::lock_guard lock{mutex_};
+      calls_.Erase(key);
+    }
+
+    {
+      std::lock_guard lock{call->mutex};
+      call->result = result;
+    }
+    call->done.notify_all();
+
+    return result;
+  }
+
+private:
+  struct Call {
+    std::mutex mutex;
+    std::condition_variable done;
+    std::shared_ptr<const V> result;
+  };
+
+  std::mutex mutex_;
+  FlatMap<K, std::shared_ptr<Call>, H> calls_;
+};
+
+} // namespace yai
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace yai {
+
+// Bounded lock-free ring for one producer thread and one consumer thread.
+// Push and Pop never block; WaitPush and WaitPop park the calling side on
+// a futex until the other side makes progress. The producer ends the stream
+// with Finish, and the consumer gives up on it with Close.
+template <class T, std::size_t CAPACITY> class SpscQueue {
+  static_assert(std::has_single_bit(CAPACITY));
+
+public:
+  // Moves from value and returns true when there was room.
+  bool Push(T &value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail - head_.load(std::memory_order_acquire) == CAPACITY)
+      return false;
+
+    slots_[tail & (CAPACITY - 1)] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    Signal();
+
+    return true;
+  }
+
+  bool Pop(T &value) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+
+    value = std::move(slots_[head & (CAPACITY - 1)]);
+    head_.store(head + 1, std::memory_order_release);
+    Signal();
+
+    return true;
+  }
+
+  // Producer side: blocks until there is room or the consumer closed.
+  void WaitPush() {
+    Wait([&] {
+      return closed() || tail_.load(std::memory_order_relaxed) -
+                                 head_.load(std::memory_order_acquire) <
+                             CAPACITY;
+    });
+  }
+
+  // Consumer side: blocks until there is an item or the producer finished.
+  void WaitPop() {
+    Wait([&] {
+      return finished() || head_.load(std::memory_order_relaxed) !=
+                               tail_.load(std::memory_order_acquire);
+    });
+  }
+
+  void Finish() {
+    finished_.store(true, std::memory_order_release);
+    Signal();
+  }
+
+  void Close() {
+    closed_.store(true, std::memory_order_release);
+    Signal();
+  }
+
+  bool finished() const { return finished_.load(std::memory_order_acquire); }
+
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+  void Signal() {
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_all();
+  }
+
+  template <class F> void Wait(F &&ready) {
+    for (;;) {
+      const std::uint32_t signal = signal_.load(std::memory_order_acquire);
+      if (ready())
+        return;
+      signal_.wait(signal, std::memory_order_acquire);
+    }
+  }
+
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  alignas(64) std::atomic<std::uint32_t> signal_{0};
+  std::atomic<bool> finished_{false}, closed_{false};
+  std::array<T, CAPACITY> slots_{};
+};
+
+} // namespace yai
@@ -0,0 +1,92 @@
+#include "yai-time.hpp"
+
+namespace yai::time {
+
+namespace {
+
+inline static bool Digits(std::string_view s, std::size_t pos, std::size_t n,
+                          int &value) {
+  value = 0;
+  for (std::size_t i = pos; i < pos + n; ++i) {
+    const unsigned d = static_cast<unsigned>(s[i] - '0');
+    if (d > 9)
+      return false;
+    value = value * 10 + static_cast<int>(d);
+  }
+  return true;
+}
+
+inline static bool IsLeap(int y) {
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+inline static int DaysInMonth(int y, int m) {
+  static constexpr int days[] = {31, 28, 31, 30, 31, 30,
+                                 31, 31, 30, 31, 30, 31};
+  return m == 2 && IsLeap(y) ? 29 : days[m - 1];
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date.
+inline static std::int64_t DaysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  const int era = (y >= 0 ? y : y - 399) / 400;
+  const int yoe = y - era * 400;
+  const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return static_cast<std::int64_t>(era) * 146097 + doe - 719468;
+}
+
+static constexpr std::int64_t PG_EPOCH_DAYS = 10957;
+static constexpr std::int64_t USECS_PER_SEC = 1000000;
+static constexpr std::int64_t USECS_PER_DAY = 86400 * USECS_PER_SEC;
+
+} // namespace
+
+std::optional<PgTimestamp> ParseTimestamp(std::string_view s) {
+  // YYYY-MM-DD?HH:MM:SS
+  //           ^ position 10
+  static constexpr std::size_t FIXED = 19;
+
+  if (s.size() < FIXED || s[4] != '-' || s[7] != '-' ||
+      (s[10] != ' ' && s[10] != 'T') || s[13] != ':' || s[16] != ':')
+    return std::nullopt;
+
+  int year, month, day, hour, minute, second;
+  if (!Digits(s, 0, 4, year) || !Digits(s, 5, 2, month) ||
+      !Digits(s, 8, 2, day) || !Digits(s, 11, 2, hour) ||
+      !Digits(s, 14, 2, minute) || !Digits(s, 17, 2, second))
+    return std::nullopt;
+
+  if (month < 1 || month > 12 || day < 1 || day > DaysInMonth(year, month) ||
+      hour > 23 || minute > 59 || second > 59)
+    return std::nullopt;
+
+  std::size_t pos = FIXED;
+  std::int64_t usecs = 0;
+
+  if (pos < s.size() && s[pos] == '.') {
+    std::size_t digits = 0;
+    for (++pos; pos < s.size() && s[pos] >= '0' && s[pos] <= '9'; ++pos) {
+      if (++digits > 6)
+        return std::nullopt;
+      usecs = usecs * 10 + (s[pos] - '0');
+    }
+    if (!digits)
+      return std::nullopt;
+    for (; digits < 6; ++digits)
+      usecs *= 10;
+  }
+
+  if (pos < s.size() && s[pos] == 'Z')
+    ++pos;
+
+  if (pos != s.size())
+    return std::nullopt;
+
+  const std::int64_t days = DaysFromCivil(year, month, day) - PG_EPOCH_DAYS;
+  const std::int64_t secs = hour * 3600 + minute * 60 + second;
+
+  return days * USECS_PER_DAY + secs * USECS_PER_SEC + usecs;
+}
+
+} // namespace yai::time
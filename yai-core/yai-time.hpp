@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace yai::time {
+
+// Microseconds since 2000-01-01 00:00:00, the Postgres timestamp epoch.
+using PgTimestamp = std::int64_t;
+
+// Parses "YYYY-MM-DD HH:MM:SS" or ISO 8601 "YYYY-MM-DDTHH:MM:SS", both with
+// optional fractional seconds (up to microseconds) and an optional trailing
+// Z. Anything else, including out of range fields, yields nullopt.
+std::optional<PgTimestamp> ParseTimestamp(std::string_view s);
+
+} // namespace yai::time
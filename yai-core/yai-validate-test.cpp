@@ -0,0 +1,172 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "yai-validate.hpp"
+
+// Checks the vector kernels against the scalar reference, with every bad
+// byte placed at each lane of the first blocks and in the scalar tail.
+
+namespace {
+
+namespace validate = yai::validate;
+
+// Long enough for two full blocks and a tail of every length.
+static constexpr std::size_t MAX_SIZE = 3 * 16 + 1;
+
+static unsigned failures = 0;
+
+static void Check(bool ok, std::string_view what, const std::string &s) {
+  if (ok)
+    return;
+
+  ++failures;
+  std::cerr << "FAIL " << what << " size " << s.size() << ":";
+  for (const char c : s)
+    std::cerr << ' ' << std::hex << (static_cast<unsigned>(c) & 0xFF)
+              << std::dec;
+  std::cerr << std::endl;
+}
+
+static void Utf8(const std::string &s, bool expected) {
+  Check(validate::Utf8(s) == expected, "Utf8", s);
+  Check(validate::scalar::Utf8(s) == expected, "scalar::Utf8", s);
+}
+
+static void Name(const std::string &s, bool expected) {
+  Check(validate::Name(s) == expected, "Name", s);
+  Check(validate::scalar::Name(s) == expected, "scalar::Name", s);
+}
+
+static void FindEither(const std::string &s, std::size_t expected) {
+  Check(validate::FindEither(s, '"', '\\') == expected, "FindEither", s);
+  Check(validate::scalar::FindEither(s, '"', '\\') == expected,
+        "scalar::FindEither", s);
+}
+
+// s with insert written over it at position i.
+static std::string Put(std::string s, std::size_t i, std::string_view insert) {
+  return s.replace(i, insert.size(), insert);
+}
+
+static void Utf8Cases() {
+  static constexpr std::string_view VALID[] = {
+      "\xC3\xA1", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEF\xBF\xBF",
+      "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF"};
+  static constexpr std::string_view INVALID[] = {
+      "\x80",         "\xBF",         "\xC0\x80",     "\xC1\xBF",
+      "\xF5\x80",     "\xFF",         "\xE0\x80\x80", "\xED\xA0\x80",
+      "\xF0\x80\x80\x80", "\xF4\x90\x80\x80", "\xC3\x41",  "\xE1\x80\x41"};
+
+  for (std::size_t n = 0; n <= MAX_SIZE; ++n) {
+    const std::string ascii(n, 'a');
+    Utf8(ascii, true);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      for (const std::string_view v : VALID)
+        if (i + v.size() <= n)
+          Utf8(Put(ascii, i, v), true);
+
+      for (const std::string_view v : INVALID)
+        if (i + v.size() <= n)
+          Utf8(Put(ascii, i, v), false);
+    }
+
+    // Sequences cut short by the end of the string.
+    for (const std::string_view v : VALID)
+      for (std::size_t k = 1; k < v.size() && k <= n; ++k)
+        Utf8(Put(ascii, n - k, v.substr(0, k)), false);
+  }
+}
+
+static void NameCases() {
+  static constexpr std::string_view ACCENTS[] = {
+      "\xC3\xA1", "\xC3\xA9", "\xC3\xAD", "\xC3\xB3", "\xC3\xBA", "\xC3\xB1"};
+  static constexpr std::string_view INVALID[] = {
+      "1", "-", "@", "[", "`", "{", "\x80", "\xC3\x81", "\xC3\x41",
+      "\xA1\xC3", "\xE2\x82\xAC"};
+
+  for (std::size_t n = 0; n <= MAX_SIZE; ++n) {
+    const std::string name(n, 'B');
+    Name(name, true);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      Name(Put(name, i, " "), true);
+
+      for (const std::string_view v : ACCENTS)
+        if (i + v.size() <= n)
+          Name(Put(name, i, v), true);
+
+      for (const std::string_view v : INVALID)
+        if (i + v.size() <= n)
+          Name(Put(name, i, v), false);
+    }
+
+    if (n)
+      Name(Put(name, n - 1, "\xC3"), false);
+  }
+}
+
+static void FindEitherCases() {
+  for (std::size_t n = 0; n <= MAX_SIZE; ++n) {
+    const std::string s(n, 'x');
+    FindEither(s, n);
+
+    for (std::size_t i = 0; i < n; ++i) {
+      FindEither(Put(s, i, "\""), i);
+      FindEither(Put(s, i, "\\"), i);
+      FindEither(Put(s, i, "\xA2"), n);
+
+      if (i + 2 <= n)
+        FindEither(Put(s, i, "\\\""), i);
+    }
+  }
+}
+
+// Random mixes of ASCII, valid sequences and stray bytes, compared with the
+// scalar reference only.
+static void Mixed() {
+  static constexpr std::string_view PIECES[] = {
+      "a", " ", "Z", "0", ":", "\"", "\\", "\xC3\xB1", "\xC3\xA1",
+      "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\x80", "\xC3", "\xED\xA0\x80"};
+
+  std::uint64_t state = 0x9E3779B97F4A7C15ULL;
+  const auto next = [&] {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  };
+
+  for (unsigned round = 0; round < 20000; ++round) {
+    std::string s;
+    const std::size_t pieces = next() % 40;
+
+    for (std::size_t k = 0; k < pieces; ++k)
+      s.append(PIECES[next() % std::size(PIECES)]);
+
+    Check(validate::Utf8(s) == validate::scalar::Utf8(s), "Utf8 mixed", s);
+    Check(validate::Name(s) == validate::scalar::Name(s), "Name mixed", s);
+    Check(validate::FindEither(s, '"', '\\') ==
+              validate::scalar::FindEither(s, '"', '\\'),
+          "FindEither mixed", s);
+  }
+}
+
+} // namespace
+
+int main() {
+  Utf8Cases();
+  NameCases();
+  FindEitherCases();
+  Mixed();
+
+  if (failures) {
+    std::cerr << failures << " failures" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+#include <bit>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "yai-validate.hpp"
+
+namespace yai::validate {
+
+namespace {
+
+inline static const std::uint8_t *Bytes(std::string_view s) {
+  return static_cast<const std::uint8_t *>(
+      static_cast<const void *>(s.data()));
+}
+
+// End of the UTF-8 sequence starting at i, or 0 when it is malformed.
+inline static std::size_t Utf8Step(const std::uint8_t *p, std::size_t n,
+                                   std::size_t i) {
+  const std::uint8_t c = p[i];
+
+  if (c < 0x80)
+    return i + 1;
+
+  std::size_t len = 0;
+  std::uint8_t lo = 0x80, hi = 0xBF;
+
+  if (c >= 0xC2 && c <= 0xDF) {
+    len = 2;
+  } else if (c == 0xE0) {
+    len = 3;
+    lo = 0xA0;
+  } else if (c == 0xED) {
+    len = 3;
+    hi = 0x9F;
+  } else if (c >= 0xE1 && c <= 0xEF) {
+    len = 3;
+  } else if (c == 0xF0) {
+    len = 4;
+    lo = 0x90;
+  } else if (c >= 0xF1 && c <= 0xF3) {
+    len = 4;
+  } else if (c == 0xF4) {
+    len = 4;
+    hi = 0x8F;
+  } else {
+    return 0;
+  }
+
+  if (n - i < len || p[i + 1] < lo || p[i + 1] > hi)
+    return 0;
+
+  for (std::size_t k = 2; k < len; ++k)
+    if ((p[i + k] & 0xC0) != 0x80)
+      return 0;
+
+  return i + len;
+}
+
+inline static bool IsNameAscii(std::uint8_t c) {
+  const std::uint8_t lower = static_cast<std::uint8_t>(c | 0x20);
+  return (lower >= 'a' && lower <= 'z') || c == ' ';
+}
+
+// End of the name character starting at i, or 0 when it is not allowed.
+inline static std::size_t NameStep(const std::uint8_t *p, std::size_t n,
+                                   std::size_t i) {
+  if (IsNameAscii(p[i]))
+    return i + 1;
+
+  // á é í ó ú ñ are C3 followed by A1 A9 AD B3 BA B1.
+  if (p[i] != 0xC3 || i + 1 == n)
+    return 0;
+
+  switch (p[i + 1]) {
+  case 0xA1:
+  case 0xA9:
+  case 0xAD:
+  case 0xB3:
+  case 0xBA:
+  case 0xB1:
+    return i + 2;
+  default:
+    return 0;
+  }
+}
+
+#if defined(__SSE2__)
+
+inline static __m128i Load(const std::uint8_t *p) {
+  return _mm_loadu_si128(
+      static_cast<const __m128i *>(static_cast<const void *>(p)));
+}
+
+// Lanes where lo <= v <= lo + span, compared as unsigned bytes.
+inline static __m128i InRange(__m128i v, char lo, char span) {
+  const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(span)), t);
+}
+
+inline static unsigned Mask(__m128i v) {
+  return static_cast<unsigned>(_mm_movemask_epi8(v));
+}
+
+inline static unsigned NonAsciiMask(const std::uint8_t *p) {
+  return Mask(Load(p));
+}
+
+inline static unsigned NameMask(const std::uint8_t *p) {
+  const __m128i v = Load(p);
+  const __m128i letter =
+      InRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+  return Mask(_mm_or_si128(letter, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+}
+
+inline static unsigned EitherMask(const std::uint8_t *p, char a, char b) {
+  const __m128i v = Load(p);
+  return Mask(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)),
+                           _mm_cmpeq_epi8(v, _mm_set1_epi8(b))));
+}
+
+#elif defined(__ARM_NEON)
+
+// Packs the 0x00/0xFF lanes of v into one bit per lane, like movemask.
+inline static unsigned Mask(uint8x16_t v) {
+  static const std::uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                           1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t bits = vandq_u8(v, vld1q_u8(weights));
+  return static_cast<unsigned>(vaddv_u8(vget_low_u8(bits))) |
+         static_cast<unsigned>(vaddv_u8(vget_high_u8(bits))) << 8;
+}
+
+inline static unsigned NonAsciiMask(const std::uint8_t *p) {
+  return Mask(vcgeq_u8(vld1q_u8(p), vdupq_n_u8(0x80)));
+}
+
+inline static unsigned NameMask(const std::uint8_t *p) {
+  const uint8x16_t v = vld1q_u8(p);
+  const uint8x16_t lower = vsubq_u8(vorrq_u8(v, vdupq_n_u8(0x20)),
+                                    vdupq_n_u8('a'));
+  return Mask(vorrq_u8(vcleq_u8(lower, vdupq_n_u8('z' - 'a')),
+                       vceqq_u8(v, vdupq_n_u8(' '))));
+}
+
+inline static unsigned EitherMask(const std::uint8_t *p, char a, char b) {
+  const uint8x16_t v = vld1q_u8(p);
+  const uint8x16_t va = vdupq_n_u8(static_cast<std::uint8_t>(a));
+  const uint8x16_t vb = vdupq_n_u8(static_cast<std::uint8_t>(b));
+  return Mask(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)));
+}
+
+#endif
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+static constexpr std::size_t LANES = 16;
+static constexpr unsigned ALL = 0xFFFF;
+#endif
+
+} // namespace
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+
+bool Utf8(std::string_view s) {
+  const std::uint8_t *p = Bytes(s);
+  const std::size_t n = s.size();
+  std::size_t i = 0;
+
+  while (i + LANES <= n) {
+    const unsigned mask = NonAsciiMask(p + i);
+
+    if (!mask) {
+      i += LANES;
+      continue;
+    }
+
+    i += static_cast<std::size_t>(std::countr_zero(mask));
+    if (!(i = Utf8Step(p, n, i)))
+      return false;
+  }
+
+  while (i < n)
+    if (!(i = Utf8Step(p, n, i)))
+      return false;
+
+  return true;
+}
+
+bool Name(std::string_view s) {
+  const std::uint8_t *p = Bytes(s);
+  const std::size_t n = s.size();
+  std::size_t i = 0;
+
+  while (i + LANES <= n) {
+    const unsigned mask = NameMask(p + i);
+
+    if (mask == ALL) {
+      i += LANES;
+      continue;
+    }
+
+    i += static_cast<std::size_t>(std::countr_zero(~mask & ALL));
+    if (!(i = NameStep(p, n, i)))
+      return false;
+  }
+
+  while (i < n)
+    if (!(i = NameStep(p, n, i)))
+      return false;
+
+  return true;
+}
+
+std::size_t FindEither(std::string_view s, char a, char b) {
+  const std::uint8_t *p = Bytes(s);
+  const std::size_t n = s.size();
+  std::size_t i = 0;
+
+  for (; i + LANES <= n; i += LANES)
+    if (const unsigned mask = EitherMask(p + i, a, b))
+      return i + static_cast<std::size_t>(std::countr_zero(mask));
+
+  for (; i < n; ++i)
+    if (s[i] == a || s[i] == b)
+      return i;
+
+  return n;
+}
+
+#else
+
+bool Utf8(std::string_view s) { return scalar::Utf8(s); }
+
+bool Name(std::string_view s) { return scalar::Name(s); }
+
+std::size_t FindEither(std::string_view s, char a, char b) {
+  return scalar::FindEither(s, a, b);
+}
+
+#endif
+
+namespace scalar {
+
+bool Utf8(std::string_view s) {
+  const std::uint8_t *p = Bytes(s);
+  std::size_t i = 0;
+
+  while (i < s.size())
+    if (!(i = Utf8Step(p, s.size(), i)))
+      return false;
+
+  return true;
+}
+
+bool Name(std::string_view s) {
+  const std::uint8_t *p = Bytes(s);
+  std::size_t i = 0;
+
+  while (i < s.size())
+    if (!(i = NameStep(p, s.size(), i)))
+      return false;
+
+  return true;
+}
+
+std::size_t FindEither(std::string_view s, char a, char b) {
+  for (std::size_t i = 0; i < s.size(); ++i)
+    if (s[i] == a || s[i] == b)
+      return i;
+
+  return s.size();
+}
+
+} // namespace scalar
+
+} // namespace yai::validate
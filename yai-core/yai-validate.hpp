@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace yai::validate {
+
+// Well-formed UTF-8: no overlongs, surrogates or code points past U+10FFFF.
+bool Utf8(std::string_view s);
+
+// ASCII letters, space and the lowercase áéíóúñ.
+bool Name(std::string_view s);
+
+// Position of the first a or b in s, or s.size().
+std::size_t FindEither(std::string_view s, char a, char b);
+
+// Appends s to out with a backslash before every " and \, as in the
+// elements of a Postgres array literal.
+template <class S> void AppendArrayElement(S &out, std::string_view s) {
+  for (;;) {
+    const std::size_t i = FindEither(s, '"', '\\');
+    out.append(s.data(), i);
+    if (i == s.size())
+      return;
+    out.push_back('\\');
+    out.push_back(s[i]);
+    s.remove_prefix(i + 1);
+  }
+}
+
+// Byte-at-a-time versions of the kernels above, kept as the reference the
+// vector paths must agree with.
+namespace scalar {
+
+bool Utf8(std::string_view s);
+bool Name(std::string_view s);
+std::size_t FindEither(std::string_view s, char a, char b);
+
+} // namespace scalar
+
+} // namespace yai::validate
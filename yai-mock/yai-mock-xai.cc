@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+
+#include <utils.hpp>
+
+// Local stand-in for the xAI chat completions API, for benchmarks and
+// offline runs: point XAI_BASE_URL at http://127.0.0.1:<port>/v1.
+//
+// Every answer is paced like a real model: the first token after the
+// latency, then tokens at the token rate. Questions starting with "!task"
+// get the canned ---FIN--- task answer instead of filler text.
+
+namespace {
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+using tcp = asio::ip::tcp;
+
+struct Options {
+  std::chrono::milliseconds latency{200};
+  unsigned tokens_per_second = 50, tokens = 100;
+};
+
+inline static Options options;
+
+// Filler answer, streamed a word per token.
+constexpr std::string_view LOREM =
+    "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
+    "tempor incididunt ut labore et dolore magna aliqua. ";
+
+inline static std::vector<std::string_view> Words(std::string_view text) {
+  std::vector<std::string_view> words;
+
+  for (std::size_t start = 0, end; start < text.size(); start = end + 1) {
+    end = text.find(' ', start);
+    words.push_back(text.substr(start, end - start + 1));
+  }
+
+  return words;
+}
+
+// What a model answers once a task is confirmed; see sinput.
+constexpr std::string_view TASK[] = {"---FIN---\n",
+                                     "BOOKING\n",
+                                     "nombre de cliente: ",
+                                     "Tony Stark\n",
+                                     "fecha de visita: ",
+                                     "2024-01-15\n",
+                                     "ubicación: ",
+                                     "Gotham\n",
+                                     "---AWK---\n",
+                                     "Visita registrada.",
+                                     " ¡Gracias!"};
+
+// Content of the last user message of a request body.
+inline static std::string LastQuestion(const boost::json::value &body) {
+  const boost::json::object *object = body.if_object();
+  const boost::json::value *messages =
+      object ? object->if_contains("messages") : nullptr;
+
+  if (!messages || !messages->if_array())
+    return {};
+
+  std::string question;
+
+  for (const boost::json::value &message : *messages->if_array()) {
+    const boost::json::object *m = message.if_object();
+    const boost::json::value *role = m ? m->if_contains("role") : nullptr;
+    const boost::json::value *content =
+        m ? m->if_contains("content") : nullptr;
+
+    if (role && content && role->if_string() && content->if_string() &&
+        *role->if_string() == "user")
+      question = content->if_string()->c_str();
+  }
+
+  return question;
+}
+
+// Calls f(token) for each token of the answer, paced by the options.
+template <class F> inline static void Answer(bool task, F &&f) {
+  const auto start = std::chrono::steady_clock::now() + options.latency;
+  const std::chrono::microseconds per_token{
+      1000000 / std::max(options.tokens_per_second, 1u)};
+
+  static const std::vector<std::string_view> words = Words(LOREM);
+
+  const unsigned count =
+      task ? static_cast<unsigned>(std::size(TASK)) : options.tokens;
+
+  for (unsigned i = 0; i < count; ++i) {
+    std::this_thread::sleep_until(start + i * per_token);
+    if (!f(task ? TASK[i] : words[i % words.size()]))
+      return;
+  }
+}
+
+inline static std::string Chunk(std::string_view token) {
+  const boost::json::object payload{
+      {"object", "chat.completion.chunk"},
+      {"choices",
+       boost::json::array{boost::json::object{
+           {"index", 0},
+           {"delta", boost::json::object{{"content", token}}}}}}};
+
+  return "data: " + boost::json::serialize(payload) + "\n\n";
+}
+
+inline static std::string Completion(std::string_view content) {
+  const boost::json::object payload{
+      {"object", "chat.completion"},
+      {"choices", boost::json::array{boost::json::object{
+                      {"index", 0},
+                      {"message", boost::json::object{{"role", "assistant"},
+                                                      {"content", content}}},
+                      {"finish_reason", "stop"}}}}};
+
+  return boost::json::serialize(payload);
+}
+
+inline static void Reply(tcp::socket &socket,
+                         const http::request<http::string_body> &request,
+                         http::status status, std::string body,
+                         beast::error_code &ec) {
+  http::response<http::string_body> response{status, request.version()};
+  response.set(http::field::content_type, "application/json");
+  response.keep_alive(request.keep_alive());
+  response.body() = std::move(body);
+  response.prepare_payload();
+  http::write(socket, response, ec);
+}
+
+inline static void Stream(tcp::socket &socket,
+                          const http::request<http::string_body> &request,
+                          bool task, beast::error_code &ec) {
+  http::response<http::empty_body> response{http::status::ok,
+                                            request.version()};
+  response.set(http::field::content_type, "text/event-stream");
+  response.keep_alive(request.keep_alive());
+  response.chunked(true);
+
+  http::response_serializer<http::empty_body> serializer{response};
+  http::write_header(socket, serializer, ec);
+
+  Answer(task, [&](std::string_view token) {
+    const std::string chunk = Chunk(token);
+    asio::write(socket, http::make_chunk(asio::buffer(chunk)), ec);
+    return !ec;
+  });
+
+  if (ec)
+    return;
+
+  static constexpr std::string_view DONE = "data: [DONE]\n\n";
+  asio::write(socket, http::make_chunk(asio::buffer(DONE)), ec);
+  if (!ec)
+    asio::write(socket, http::make_chunk_last(), ec);
+}
+
+inline static void Serve(tcp::socket socket) {
+  beast::flat_buffer buffer;
+  beast::error_code ec;
+
+  socket.set_option(tcp::no_delay{true}, ec);
+
+  for (;;) {
+    http::request<http::string_body> request;
+    http::read(socket, buffer, request, ec);
+
+    if (ec)
+      return;
+
+    if (request.method() != http::verb::post ||
+        !request.target().ends_with("/chat/completions")) {
+      Reply(socket, request, http::status::not_found,
+            R"({"error":"not found"})", ec);
+    } else {
+      boost::json::error_code json_ec;
+      const boost::json::value body =
+          boost::json::parse(request.body(), json_ec);
+      const boost::json::object *object = body.if_object();
+      const boost::json::value *stream =
+          object ? object->if_contains("stream") : nullptr;
+      const bool task = LastQuestion(body).starts_with("!task");
+
+      if (json_ec) {
+        Reply(socket, request, http::status::bad_request,
+              R"({"error":"invalid JSON"})", ec);
+      } else if (stream && stream->is_bool() && stream->get_bool()) {
+        Stream(socket, request, task, ec);
+      } else {
+        std::string content;
+        Answer(task, [&](std::string_view token) {
+          content += token;
+          return true;
+        });
+        Reply(socket, request, http::status::ok, Completion(content), ec);
+      }
+    }
+
+    if (ec || !request.keep_alive())
+      return;
+  }
+}
+
+inline static void Usage(const char *name) {
+  std::cerr << "Usage: " << name
+            << " <port> [latency-ms] [tokens-per-second] [tokens]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 5) {
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    if (argc > 2)
+      options.latency = std::chrono::milliseconds{std::stoul(argv[2])};
+    if (argc > 3)
+      options.tokens_per_second = static_cast<unsigned>(std::stoul(argv[3]));
+    if (argc > 4)
+      options.tokens = static_cast<unsigned>(std::stoul(argv[4]));
+
+    asio::io_context io;
+    tcp::acceptor acceptor{
+        io, {asio::ip::make_address("127.0.0.1"),
+             yai::utils::StoPortNum(argv[1])}};
+
+    for (;;)
+      std::thread{Serve, acceptor.accept()}.detach();
+  } catch (std::exception &e) {
+    std::cerr << "Runtime error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
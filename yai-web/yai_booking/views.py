@@ -4,7 +4,7 @@ from abc import ABC, abstractmethod
 from typing import override
 
 import yai_booking_abi
-from django.core.files.uploadedfile import InMemoryUploadedFile
+from django.core.files.uploadedfile import TemporaryUploadedFile
 from django.http import (
     HttpRequest,
     HttpResponse,
@@ -98,12 +98,12 @@ class SimpleImportView(FormView, ABC):
     form_class = ImportFileForm
 
     def form_valid(self, form: ImportFileForm) -> HttpResponseRedirect:
-        data_file: InMemoryUploadedFile = form.cleaned_data["file"]
-        self.Import(data_file.read())
+        data_file: TemporaryUploadedFile = form.cleaned_data["file"]
+        self.Import(data_file.temporary_file_path())
         return super().form_valid(form)
 
     @abstractmethod
-    def Import(self, data: bytes) -> None: ...
+    def Import(self, path: str) -> None: ...
 
 
 class ImportCSVConsultantsView(SimpleImportView):
@@ -111,8 +111,8 @@ class ImportCSVConsultantsView(SimpleImportView):
     success_url = reverse_lazy("yai_booking:import:csv:consultants")
 
     @override
-    def Import(self, data: bytes) -> None:
-        yai_booking_abi.ImportCSVConsultants(data)
+    def Import(self, path: str) -> None:
+        yai_booking_abi.ImportCSVConsultantsFile(path)
 
 
 class ImportCSVCustomersView(SimpleImportView):
@@ -120,8 +120,8 @@ class ImportCSVCustomersView(SimpleImportView):
     success_url = reverse_lazy("yai_booking:import:csv:customers")
 
     @override
-    def Import(self, data: bytes) -> None:
-        yai_booking_abi.ImportCSVCustomers(data)
+    def Import(self, path: str) -> None:
+        yai_booking_abi.ImportCSVCustomersFile(path)
 
 
 class ImportCSVBooking(SimpleImportView):
@@ -129,12 +129,12 @@ class ImportCSVBooking(SimpleImportView):
     success_url = reverse_lazy("yai_booking:import:csv:booking")
 
     @override
-    def Import(self, data: bytes) -> None:
-        yai_booking_abi.ImportCSVBooking(data)
+    def Import(self, path: str) -> None:
+        yai_booking_abi.ImportCSVBookingFile(path)
 
 
 class AiConsultantsSummaryView(View):
 
     def get(self, _: HttpRequest) -> HttpResponse:
-        res = yai_booking_abi.AiConsultantsSummary()
+        res = yai_booking_abi.AiConsultantsSummaryUpdate()
         return HttpResponse(res, content_type="application/json")
@@ -1,5 +1,30 @@
-def ImportJSON(data: bytes) -> None: ...
-def ImportCSVConsultants(data: bytes) -> None: ...
-def ImportCSVCustomers(data: bytes) -> None: ...
-def ImportCSVBooking(data: bytes) -> None: ...
+from asyncio import Future
+from collections.abc import Buffer
+from os import PathLike
+from typing import IO, Any, Optional
+
+RowErrors = list[tuple[int, str]]
+File = str | bytes | PathLike[str] | int | IO[bytes]
+
+def ImportJSON(data: Buffer) -> RowErrors: ...
+def ImportJSONAsync(data: Buffer) -> Future[RowErrors]: ...
+def ImportJSONFile(file: File) -> RowErrors: ...
+def ImportJSONFileAsync(file: File) -> Future[RowErrors]: ...
+def ImportCSVConsultants(data: Buffer) -> None: ...
+def ImportCSVConsultantsAsync(data: Buffer) -> Future[None]: ...
+def ImportCSVConsultantsFile(file: File) -> None: ...
+def ImportCSVConsultantsFileAsync(file: File) -> Future[None]: ...
+def ImportCSVCustomers(data: Buffer) -> None: ...
+def ImportCSVCustomersAsync(data: Buffer) -> Future[None]: ...
+def ImportCSVCustomersFile(file: File) -> None: ...
+def ImportCSVCustomersFileAsync(file: File) -> Future[None]: ...
+def ImportCSVBooking(data: Buffer) -> RowErrors: ...
+def ImportCSVBookingAsync(data: Buffer) -> Future[RowErrors]: ...
+def ImportCSVBookingFile(file: File) -> RowErrors: ...
+def ImportCSVBookingFileAsync(file: File) -> Future[RowErrors]: ...
 def AiConsultantsSummary() -> bytes: ...
+def AiConsultantsSummaryAsync() -> Future[bytes]: ...
+def AiConsultantsSummaryUpdate() -> bytes: ...
+def AiConsultantsSummaryUpdateAsync() -> Future[bytes]: ...
+def CacheStats() -> Optional[dict[str, int]]: ...
+def SchedulerStats() -> dict[str, Any]: ...
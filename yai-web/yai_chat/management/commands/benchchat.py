@@ -0,0 +1,173 @@
+import subprocess
+import time
+from statistics import quantiles
+from typing import Any, Callable, Dict, List, Optional
+
+from django.conf import settings
+from django.core.management.base import (
+    BaseCommand,
+    CommandError,
+    CommandParser,
+)
+
+
+class Command(BaseCommand):
+
+    help = (
+        "Benchmark ProcessMessage and ProcessPartial against the local"
+        " yai-mock-xai server"
+    )
+
+    def add_arguments(self, parser: CommandParser) -> None:
+        parser.add_argument(
+            "--mock",
+            help="yai-mock-xai binary to start; otherwise it must be running",
+        )
+        parser.add_argument("--port", type=int, default=8090)
+        parser.add_argument("--latency-ms", type=int, default=200)
+        parser.add_argument("--tokens-per-second", type=int, default=50)
+        parser.add_argument("--tokens", type=int, default=100)
+        parser.add_argument("--calls", type=int, default=20)
+        parser.add_argument(
+            "--task",
+            action="store_true",
+            help="ask for the canned ---FIN--- task answer",
+        )
+
+    def handle(self, *_: Any, **options: Any) -> None:
+        # Read by the ABI on first use, so set before any call.
+        settings.XAI_BASE_URL = f"http://127.0.0.1:{options['port']}/v1"
+        settings.XAI_API_KEY = settings.XAI_API_KEY or "mock"
+        settings.YAI_CACHE_BYTES = 0
+
+        server: Optional[subprocess.Popen[bytes]] = None
+
+        if options["mock"]:
+            server = subprocess.Popen(
+                [
+                    options["mock"],
+                    str(options["port"]),
+                    str(options["latency_ms"]),
+                    str(options["tokens_per_second"]),
+                    str(options["tokens"]),
+                ]
+            )
+            time.sleep(0.2)
+
+        try:
+            bench = Bench(options)
+            self.Report("ProcessMessage", bench.Run(bench.Message))
+            partial = bench.Run(bench.Partial)
+            self.Report("ProcessPartial", partial)
+            bench.CheckTtft(partial)
+        finally:
+            if server:
+                server.terminate()
+                server.wait()
+
+    def Report(self, name: str, samples: List[Dict[str, float]]) -> None:
+        self.stdout.write(f"{name} ({len(samples)} calls)")
+        self.stdout.write(f"  {'':<14}{'p50':>10}{'p95':>10}")
+
+        for metric, unit in (
+            ("wall", "ms"),
+            ("ttft", "ms"),
+            ("tokens_per_s", ""),
+            ("python", "ms"),
+            ("native", "ms"),
+        ):
+            values = sorted(sample[metric] for sample in samples)
+            p50, p95 = Percentile(values, 50), Percentile(values, 95)
+            scale = 1000 if unit == "ms" else 1
+            self.stdout.write(
+                f"  {metric + (' ' + unit if unit else ''):<14}"
+                f"{p50 * scale:>10.1f}{p95 * scale:>10.1f}"
+            )
+
+
+class Bench:
+    """
+    Each sample splits the wall time of a call into the time the mock server
+    waits on purpose (latency plus token pacing), the time spent in Python
+    callbacks, and the rest: native code and the loopback transport.
+    """
+
+    def __init__(self, options: Dict[str, Any]) -> None:
+        import yai_chat_abi
+
+        self._abi = yai_chat_abi
+        self._calls: int = options["calls"]
+        self._latency = options["latency_ms"] / 1000
+        self._rate: int = options["tokens_per_second"]
+        self._flush = getattr(settings, "YAI_STREAM_FLUSH_MS", 0) / 1000
+        self._question = "!task" if options["task"] else "Hola"
+        self._scope = {"username": "bench", "today": "2024-01-15"}
+
+    def Run(
+        self, call: Callable[[], Dict[str, float]]
+    ) -> List[Dict[str, float]]:
+        call()  # Warm up the connection pool and the settings.
+        return [call() for _ in range(self._calls)]
+
+    def Message(self) -> Dict[str, float]:
+        start = time.perf_counter()
+        answer = self._abi.ProcessMessage([], self._question, self._scope)
+        wall = time.perf_counter() - start
+
+        tokens = len(answer.split()) if isinstance(answer, str) else 0
+        return self._Sample(wall, wall, tokens, 0.0)
+
+    def Partial(self) -> Dict[str, float]:
+        chunks: List[str] = []
+        first: List[float] = []
+        python = 0.0
+
+        def call(chunk: str) -> None:
+            nonlocal python
+            entered = time.perf_counter()
+            if not first:
+                first.append(entered)
+            chunks.append(chunk)
+            python += time.perf_counter() - entered
+
+        start = time.perf_counter()
+        self._abi.ProcessPartial([], self._question, self._scope, call)
+        wall = time.perf_counter() - start
+
+        ttft = (first[0] if first else start + wall) - start
+        return self._Sample(wall, ttft, len("".join(chunks).split()), python)
+
+    def CheckTtft(self, samples: List[Dict[str, float]]) -> None:
+        """
+        The first chunk of a streamed answer must reach Python a few token
+        intervals after the mock server sent it. A transport that holds the
+        body back shows up as a TTFT close to the wall time.
+        """
+        ttft = Percentile(sorted(sample["ttft"] for sample in samples), 50)
+        limit = self._latency + 5 / self._rate + self._flush + 0.1
+
+        if ttft > limit:
+            raise CommandError(
+                f"ProcessPartial p50 TTFT {ttft * 1000:.0f} ms is over"
+                f" {limit * 1000:.0f} ms: the answer is not streamed"
+            )
+
+    def _Sample(
+        self, wall: float, ttft: float, tokens: int, python: float
+    ) -> Dict[str, float]:
+        server = self._latency + max(tokens - 1, 0) / self._rate
+        # Without streaming the tokens arrive all at once, at the end.
+        generation = wall - ttft if wall > ttft else wall
+        return {
+            "wall": wall,
+            "ttft": ttft,
+            "tokens_per_s": tokens / generation if generation else 0.0,
+            "python": python,
+            "native": max(wall - server - python, 0.0),
+        }
+
+
+def Percentile(values: List[float], p: int) -> float:
+    if len(values) < 2:
+        return values[0] if values else 0.0
+    return quantiles(values, n=100, method="inclusive")[p - 1]
@@ -1,6 +1,4 @@
 from datetime import datetime
-from queue import Queue
-from threading import Thread
 from typing import Any, Dict, Iterator, List, Optional, Tuple, cast
 
 import yai_chat_abi
@@ -21,8 +19,7 @@ from markdown import markdown
 class ChatViewSupport(LoginRequiredMixin, TemplateView):
 
     def get_context_data(self, **_: Any) -> Any:
-        history_cache = HistoryCache(self.request)
-        history = history_cache.Get()
+        history = yai_chat_abi.SessionHistory(SessionId(self.request))
         return {"history": Apply(history)}
 
 
@@ -44,20 +41,22 @@ class MessageView(LoginRequiredMixin, View):
         if not question:
             return HttpResponse(b"")
 
-        history_cache = HistoryCache(request)
+        session_id = SessionId(request)
 
         if question == "/c":
-            history_cache.Delete()
+            yai_chat_abi.SessionClear(session_id)
             return HttpResponse(b"")
 
-        history = history_cache.Get()
+        error: Optional[Exception] = None
 
         try:
-            yai_chat_abi.ProcessMessage(history, question, Scope(request))
-        except Exception as error:
-            history.append((question, f"Error: {error}"))
+            yai_chat_abi.ProcessMessage(session_id, question, Scope(request))
+        except Exception as e:
+            error = e
 
-        history_cache.Put(history)
+        history = yai_chat_abi.SessionHistory(session_id)
+        if error:
+            history.append((question, f"Error: {error}"))
 
         return render(
             request,
@@ -78,58 +77,34 @@ class PartialView(LoginRequiredMixin, View):
 
         arg_cache.Delete()
 
-        queue = Queue[str]()
-
-        history_cache = HistoryCache(request)
-        history = history_cache.Get()
-
-        def process() -> None:
-            try:
-                yai_chat_abi.ProcessPartial(
-                    history, question, Scope(request), queue.put
-                )
-            except Exception as error:
-                history.append((question, f"Error: {error}"))
-
-            queue.put("data: [DONE]")
-
-        thread = Thread(target=process)
+        session_id = SessionId(request)
+        stream = yai_chat_abi.ProcessStream(
+            session_id, question, Scope(request)
+        )
 
-        def content() -> Iterator[str]:
-            thread.start()
-            history.append((question, ""))
+        def content() -> Iterator[bytes]:
+            error: Optional[Exception] = None
 
             try:
-                while True:
-                    part: str = queue.get()
-
-                    if part == "data: [DONE]":
-                        queue.task_done()
-                        break
-
-                    q, a = history[-1]
-                    history[-1] = (q, a + part)
-
-                    s = minify(
-                        render_to_string(
-                            "yai/chat/item.html",
-                            {"history": Apply(history)},
-                        ),
-                        remove_empty_space=True,
-                    )
-
-                    queue.task_done()
-
-                    yield f"data: {s}\n\n"
-
-            except (BrokenPipeError, ConnectionResetError):
-                pass
-
+                yield from stream
+            except Exception as e:
+                error = e
             finally:
-                thread.join()
-                history_cache.Put(history)
+                # Closed early when the client disconnects: stop the
+                # upstream request too.
+                stream.close()
+
+            history = yai_chat_abi.SessionHistory(session_id)
+            if error:
+                history.append((question, f"Error: {error}"))
 
-            yield "data: [DONE]\n\n"
+            yield Frame(
+                render_to_string(
+                    "yai/chat/item.html", {"history": Apply(history)}
+                ),
+                event="history",
+            )
+            yield b"data: [DONE]\n\n"
 
         response = StreamingHttpResponse(
             content(), content_type="text/event-stream"
@@ -147,10 +122,20 @@ class PartialView(LoginRequiredMixin, View):
         return HttpResponse()
 
 
+def Frame(data: str, event: Optional[str] = None) -> bytes:
+    lines = [f"event: {event}"] if event else []
+    lines.extend(f"data: {line}" for line in data.split("\n"))
+    return ("\n".join(lines) + "\n\n").encode()
+
+
 def Apply(history: List[Tuple[str, str]]) -> List[Tuple[str, str]]:
     return [(q, markdown(a)) for q, a in history]
 
 
+def SessionId(request: HttpRequest) -> str:
+    return f"{cast(Any, request).user.username}-history"
+
+
 def Scope(request: HttpRequest) -> Dict[str, str]:
     return {
         "username": cast(Any, request).user.username,
@@ -158,27 +143,6 @@ def Scope(request: HttpRequest) -> Dict[str, str]:
     }
 
 
-class HistoryCache:
-
-    def __init__(self, request: HttpRequest) -> None:
-        username = cast(Any, request).user.username
-        self._key = f"{username}-history"
-
-    def Get(self) -> List[Tuple[str, str]]:
-        history: Optional[List[Tuple[str, str]]] = cache.get(self._key)
-
-        if not history:
-            history = []
-
-        return history
-
-    def Put(self, history: List[Tuple[str, str]]) -> None:
-        cache.set(self._key, history)
-
-    def Delete(self) -> None:
-        cache.delete(self._key)
-
-
 class ArgCache:
 
     def __init__(self, request: HttpRequest) -> None:
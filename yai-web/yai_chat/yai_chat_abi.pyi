@@ -1,13 +1,58 @@
-from typing import Callable, Dict, List, Optional, Tuple
+from asyncio import Future
+from typing import (
+    Any,
+    Callable,
+    Dict,
+    Iterator,
+    List,
+    Optional,
+    Tuple,
+    Union,
+)
 
 def ProcessMessage(
-    hist: List[Tuple[str, str]],
+    hist: Union[List[Tuple[str, str]], str],
     q: str,
     scope: Optional[Dict[str, str]],
 ) -> str: ...
+def ProcessMessageAsync(
+    hist: Union[List[Tuple[str, str]], str],
+    q: str,
+    scope: Optional[Dict[str, str]],
+) -> Future[str]: ...
 def ProcessPartial(
-    hist: List[Tuple[str, str]],
+    hist: Union[List[Tuple[str, str]], str],
     q: str,
     scope: Optional[Dict[str, str]],
     call: Callable[[str], None],
+    cancel: Optional[CancelToken] = None,
 ) -> str: ...
+def ProcessPartialAsync(
+    hist: Union[List[Tuple[str, str]], str],
+    q: str,
+    scope: Optional[Dict[str, str]],
+    call: Callable[[str], None],
+    cancel: Optional[CancelToken] = None,
+) -> Future[str]: ...
+
+class CancelToken:
+    cancelled: bool
+
+    def cancel(self) -> None: ...
+
+class ProcessStream(Iterator[bytes]):
+    task: Optional[Dict[str, Any]]
+
+    def __init__(
+        self,
+        hist: Union[List[Tuple[str, str]], str],
+        q: str,
+        scope: Optional[Dict[str, str]],
+    ) -> None: ...
+    def __next__(self) -> bytes: ...
+    def close(self) -> None: ...
+
+def SessionHistory(session_id: str) -> List[Tuple[str, str]]: ...
+def SessionClear(session_id: str) -> None: ...
+def CacheStats() -> Optional[Dict[str, int]]: ...
+def SchedulerStats() -> Dict[str, Any]: ...
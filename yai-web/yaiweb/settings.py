@@ -128,6 +128,12 @@ STATIC_URL = "static/"
 
 DEFAULT_AUTO_FIELD = "django.db.models.BigAutoField"
 
+# Uploads always go to a temporary file, which the importers map in place
+# rather than reading into memory.
+FILE_UPLOAD_HANDLERS = [
+    "django.core.files.uploadhandler.TemporaryFileUploadHandler",
+]
+
 CACHES = {
     "default": {
         "BACKEND": "django.core.cache.backends.locmem.LocMemCache",
@@ -140,4 +146,21 @@ CSRF_COOKIE_NAME = "ctoken"
 CSRF_HEADER_NAME = "HTTP_X_CTOKEN"
 
 XAI_API_KEY = environ.get("XAI_API_KEY", None)
+XAI_BASE_URL = environ.get("XAI_BASE_URL", "https://api.x.ai/v1")
+# Fails an xAI request that makes no progress for this long.
+XAI_TIMEOUT_SECONDS = 120
+YAI_SYSTEM_PROMPT = str(BASE_DIR / "sinput")
+YAI_STREAM_FLUSH_BYTES = 256
+YAI_STREAM_FLUSH_MS = 30
+YAI_SESSION_TOKEN_BUDGET = 8192
+YAI_SESSION_IDLE_SECONDS = 3600
+YAI_CACHE_BYTES = 64 * 1024 * 1024
+YAI_CACHE_TTL_SECONDS = 3600
+YAI_CACHE_DIR = environ.get("YAI_CACHE_DIR", "")
+YAI_SUMMARY_CHUNK_BYTES = 32 * 1024
+YAI_SUMMARY_CONCURRENCY = 4
+# Set to the account's xAI rate limits; 0 is unlimited.
+YAI_AI_REQUESTS_PER_MINUTE = 0
+YAI_AI_TOKENS_PER_MINUTE = 0
+YAI_AI_CONCURRENCY = 16
 YAI_ABI_CONNINFO = "dbname=yai user=postgres"